@@ -1,62 +1,556 @@
 #include <memory>
 #include "common.h"
+#include "compression.h"
+#include "eviction.h"
+#include "spill.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <ostream>
 #include <unordered_map>
 #include <mutex>
-#include <list>
+#include <numeric>
+#include <optional>
+#include <string_view>
+#include <vector>
 using namespace std;
 
-class LruCache : public ICache {
-    Settings settings_;
+namespace {
+    // Counters of one shard. Everything except the latency histogram is written only under the shard lock,
+    // so a relaxed load and store replace the locked read-modify-write, and GetStats reads them without the lock.
+    struct ShardStats {
+        atomic<size_t> hits = 0;
+        atomic<size_t> misses = 0;
+        atomic<size_t> evictions = 0;
+        atomic<size_t> bytes_evicted = 0;
+        atomic<size_t> current_bytes = 0;
+        atomic<size_t> entry_count = 0;
+        atomic<size_t> prefetches = 0;
+        atomic<size_t> pending_hits = 0;
+        atomic<size_t> compressed_hits = 0;
+        atomic<size_t> compressed_bytes = 0;
+        atomic<size_t> compressed_entry_count = 0;
+        atomic<size_t> spill_hits = 0;
+        atomic<size_t> contended_locks = 0;
+        atomic<int64_t> lock_wait_ns = 0;
+        // written after the unpack, outside the lock
+        array<atomic<size_t>, ICache::Stats::LATENCY_BUCKET_COUNT> unpack_latency_us = {};
+    };
+
+    template <typename Number>
+    void AddLocked(atomic<Number>& counter, Number value) {
+        counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+    }
+
+    // A book brought back from the second tier
+    class DecompressedBook : public IBook {
+    public:
+        DecompressedBook(string name, string content) : name_(move(name)), content_(move(content)) {
+        }
+
+        const string& GetName() const override {
+            return name_;
+        }
+
+        const string& GetContent() const override {
+            return content_;
+        }
+
+    private:
+        string name_;
+        string content_;
+    };
+
+    // Compressed contents of evicted books within a byte budget, the oldest ones are dropped first
+    class CompressedTier {
+    public:
+        explicit CompressedTier(size_t max_memory = 0,
+                                ICache::Settings::Accounting accounting = ICache::Settings::Accounting::CONTENT)
+            : max_memory_(max_memory)
+            , accounting_(accounting)
+        {
+        }
+
+        // Removes the book, it is going back to the first tier
+        optional<string> Take(const string& book_name) {
+            auto it = index_.find(book_name);
+            if (it == index_.end()) {
+                return nullopt;
+            }
+            used_memory_ -= GetCharge(*it->second);
+            string compressed = move(it->second->second);
+            entries_.erase(it->second);
+            index_.erase(it);
+            return compressed;
+        }
+
+        void Insert(const string& book_name, string compressed) {
+            Take(book_name);
+            entries_.emplace_front(book_name, move(compressed));
+            const size_t charge = GetCharge(entries_.front());
+            if (charge > max_memory_) {
+                entries_.pop_front();
+                return;
+            }
+            while (used_memory_ + charge > max_memory_) {
+                used_memory_ -= GetCharge(entries_.back());
+                index_.erase(entries_.back().first);
+                entries_.pop_back();
+            }
+            used_memory_ += charge;
+            index_[book_name] = entries_.begin();
+        }
+
+        size_t GetUsedMemory() const {
+            return used_memory_;
+        }
+
+        size_t GetEntryCount() const {
+            return entries_.size();
+        }
+
+    private:
+        using Entry = pair<string, string>;  // name and compressed content
+
+        size_t max_memory_;
+        ICache::Settings::Accounting accounting_;
+        size_t used_memory_ = 0;
+        list<Entry> entries_;  // newest first
+        unordered_map<string, list<Entry>::iterator> index_;
+
+        size_t GetCharge(const Entry& entry) const {
+            if (accounting_ == ICache::Settings::Accounting::CONTENT) {
+                return entry.second.size();
+            }
+            return GetHeapSize(entry.second)
+                + GetListEntryOverhead(entry.first, sizeof(Entry), sizeof(list<Entry>::iterator));
+        }
+    };
+
+    size_t GetLatencyBucket(chrono::steady_clock::duration latency) {
+        size_t us = chrono::duration_cast<chrono::microseconds>(latency).count();
+        size_t bucket = 0;
+        for (; us > 0 && bucket + 1 < ICache::Stats::LATENCY_BUCKET_COUNT; us >>= 1) {
+            ++bucket;
+        }
+        return bucket;
+    }
+}
+
+// Key hash picks one of settings.shard_count independent shards, each with its own lock,
+// its own eviction policy and an equal share of max_memory, so readers of different books rarely wait for each other
+class ShardedCache : public ICache {
+    struct Shard {
+        unique_ptr<IEvictionPolicy> policy;
+        // misses being unpacked right now, later readers of the same book wait for the first one
+        unordered_map<string, shared_future<BookPtr>> unpacking;
+        CompressedTier compressed;
+        // books the policy evicted under the lock, moved to moving_down after the Insert
+        vector<pair<string, BookPtr>> evicted;
+        // evicted books waiting for the pool to pass them to the lower tiers, a miss takes them back from here
+        unordered_map<string, BookPtr> moving_down;
+        mutable mutex m;
+        ShardStats stats;
+    };
+
     shared_ptr<IBooksUnpacker> books_unpacker_;
-    list<BookPtr> cache;
-    unordered_map<string, list<BookPtr>::iterator> storage;
-    size_t free_space;
-    mutable mutex mutex_;
-public:
-    LruCache(shared_ptr<IBooksUnpacker> books_unpacker, const Settings& settings) :
-    settings_(settings), books_unpacker_(move(books_unpacker)), free_space(settings.max_memory){
+    hash<string_view> hasher_;
+    vector<Shard> shards_;
+    bool has_compressed_tier_;
+    // shared by the shards, it has a lock of its own
+    unique_ptr<SpillTier> spill_;
+    atomic<size_t> spill_bytes_ = 0;
+    atomic<size_t> spill_entry_count_ = 0;
+    atomic<size_t> spill_compactions_ = 0;
+    size_t pool_thread_count_;
+    once_flag pool_started_;
+    // prefetches and moving evicted books down, declared last, so the workers finish
+    // before the shards and the spill tier they write to go away
+    unique_ptr<ThreadPool> pool_;
+
+    size_t GetShardIndex(string_view book_name) const {
+        return hasher_(book_name) % shards_.size();
+    }
 
+    Shard& GetShard(string_view book_name) {
+        return shards_[GetShardIndex(book_name)];
     }
 
-    BookPtr GetBook(const string& book_name) override {
-        lock_guard guard(mutex_);
-        auto book_it = storage.find(book_name);
+    // Only a lock that is busy gets timed, the uncontended path stays free of clock reads
+    static unique_lock<mutex> LockShard(Shard& shard) {
+        unique_lock lock(shard.m, try_to_lock);
+        if (!lock.owns_lock()) {
+            const auto start = chrono::steady_clock::now();
+            lock.lock();
+            AddLocked(shard.stats.contended_locks, size_t(1));
+            AddLocked(shard.stats.lock_wait_ns, static_cast<int64_t>(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()));
+        }
+        return lock;
+    }
+
+public:
+    ShardedCache(shared_ptr<IBooksUnpacker> books_unpacker, const Settings& settings) :
+    books_unpacker_(move(books_unpacker)), shards_(max<size_t>(1, settings.shard_count)),
+    has_compressed_tier_(settings.compressed_memory > 0),
+    pool_thread_count_(max<size_t>(1, settings.background_thread_count)) {
+        if (settings.spill_disk_budget > 0) {
+            spill_ = make_unique<SpillTier>(SpillTier::Settings{
+                settings.spill_directory, settings.spill_disk_budget, settings.spill_segment_size});
+            UpdateSpillStats();
+        }
+        // the remainder goes to the first shards, so the budgets add up exactly
+        const auto share = [this](size_t memory, size_t i) {
+            return memory / shards_.size() + (i < memory % shards_.size());
+        };
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            Shard& shard = shards_[i];
+            shard.policy = MakeEvictionPolicy(settings, share(settings.max_memory, i));
+            if (has_compressed_tier_) {
+                shard.compressed = CompressedTier(share(settings.compressed_memory, i), settings.accounting);
+            }
+            if (HasLowerTiers()) {
+                shard.policy->SetEvictionListener([&shard](const string& book_name, BookPtr book) {
+                    shard.evicted.emplace_back(book_name, move(book));
+                });
+            }
+        }
+    }
+
+    // A hit takes the shard lock and one index lookup and allocates nothing
+    BookPtr GetBook(string_view book_view) override {
+        Shard& shard = GetShard(book_view);
+        unique_lock lock = LockShard(shard);
         // if book presented in cache
-        if (book_it != storage.end()) {
-            auto book = *book_it->second;
-            cache.erase(storage[book_name]);
-            cache.push_front(move(book));
-            storage[book_name] = cache.begin();
-            return *storage[book_name];
+        if (BookPtr book = shard.policy->Find(book_view)) {
+            AddLocked(shard.stats.hits, size_t(1));
+            return book;
         }
+        AddLocked(shard.stats.misses, size_t(1));
+        const string book_name(book_view);
 
-        // not presented
-        auto new_book = books_unpacker_->UnpackBook(book_name);
-        size_t new_book_size = new_book->GetContent().size();
-        
-        // if book size > cache
-        if (new_book_size > settings_.max_memory) {
-            return new_book;
+        // somebody is unpacking it already
+        if (auto unpacking_it = shard.unpacking.find(book_name); unpacking_it != shard.unpacking.end()) {
+            auto book_future = unpacking_it->second;
+            lock.unlock();
+            return book_future.get();
         }
+        promise<BookPtr> unpacked;
+        shard.unpacking.emplace(book_name, unpacked.get_future().share());
+        lock.unlock();
 
-        // if not enought memory
-        while (free_space < new_book_size) {
-            auto deleted_book = cache.back();
-            free_space += deleted_book->GetContent().size();
-            storage.erase(deleted_book->GetName());
-            cache.pop_back();
+        return Unpack(shard, book_name, unpacked);
+    }
+
+    void Prefetch(const vector<string>& book_names) override {
+        StartBatch(book_names, true);
+    }
+
+    vector<BookHandle> GetBooks(const vector<string>& book_names) override {
+        return StartBatch(book_names, false);
+    }
+
+    Stats GetStats() const override {
+        Stats result;
+        for (const Shard& shard : shards_) {
+            result.hits += shard.stats.hits.load(memory_order_relaxed);
+            result.misses += shard.stats.misses.load(memory_order_relaxed);
+            result.evictions += shard.stats.evictions.load(memory_order_relaxed);
+            result.bytes_evicted += shard.stats.bytes_evicted.load(memory_order_relaxed);
+            result.current_bytes += shard.stats.current_bytes.load(memory_order_relaxed);
+            result.entry_count += shard.stats.entry_count.load(memory_order_relaxed);
+            result.prefetches += shard.stats.prefetches.load(memory_order_relaxed);
+            result.pending_hits += shard.stats.pending_hits.load(memory_order_relaxed);
+            result.compressed_hits += shard.stats.compressed_hits.load(memory_order_relaxed);
+            result.compressed_bytes += shard.stats.compressed_bytes.load(memory_order_relaxed);
+            result.compressed_entry_count += shard.stats.compressed_entry_count.load(memory_order_relaxed);
+            result.spill_hits += shard.stats.spill_hits.load(memory_order_relaxed);
+            result.contended_locks += shard.stats.contended_locks.load(memory_order_relaxed);
+            result.lock_wait += chrono::nanoseconds(shard.stats.lock_wait_ns.load(memory_order_relaxed));
+            for (size_t i = 0; i < Stats::LATENCY_BUCKET_COUNT; ++i) {
+                result.unpack_latency_us[i] += shard.stats.unpack_latency_us[i].load(memory_order_relaxed);
+            }
+        }
+        result.spill_bytes = spill_bytes_.load(memory_order_relaxed);
+        result.spill_entry_count = spill_entry_count_.load(memory_order_relaxed);
+        result.spill_compactions = spill_compactions_.load(memory_order_relaxed);
+        return result;
+    }
+
+private:
+    bool HasLowerTiers() const {
+        return has_compressed_tier_ || spill_;
+    }
+
+    // Unpacks a book registered in shard.unpacking without holding the lock, caches it
+    // and passes it to everybody waiting on the promise. A failed unpack is not cached, its exception is rethrown.
+    BookPtr Unpack(Shard& shard, const string& book_name, promise<BookPtr>& unpacked) {
+        BookPtr new_book;
+        optional<string> compressed;
+        if (HasLowerTiers()) {
+            unique_lock lock = LockShard(shard);
+            if (auto it = shard.moving_down.find(book_name); it != shard.moving_down.end()) {
+                new_book = move(it->second);
+                shard.moving_down.erase(it);
+                AddLocked(shard.stats.pending_hits, size_t(1));
+            }
+            else if (has_compressed_tier_) {
+                compressed = shard.compressed.Take(book_name);
+                if (compressed) {
+                    AddLocked(shard.stats.compressed_hits, size_t(1));
+                }
+                UpdateCompressedStats(shard);
+            }
+            lock.unlock();
+
+            // a book the second tier held has its disk copy written long ago, it would only take space now.
+            // One still moving down may be written after this, such a redundant copy is harmless,
+            // books never change.
+            if (spill_ && compressed) {
+                spill_->Remove(book_name);
+                UpdateSpillStats();
+            }
+            else if (spill_ && !new_book) {
+                new_book = spill_->Take(book_name);
+                if (new_book) {
+                    lock.lock();
+                    AddLocked(shard.stats.spill_hits, size_t(1));
+                    lock.unlock();
+                    UpdateSpillStats();
+                }
+            }
+        }
+        const bool from_lower_tier = new_book || compressed;
+
+        const auto unpack_start = chrono::steady_clock::now();
+        try {
+            if (compressed) {
+                new_book = make_shared<DecompressedBook>(book_name, Lz::Decompress(*compressed));
+            }
+            else if (!new_book) {
+                new_book = books_unpacker_->UnpackBook(book_name);
+            }
+        }
+        catch (...) {
+            unique_lock lock = LockShard(shard);
+            shard.unpacking.erase(book_name);
+            lock.unlock();
+            unpacked.set_exception(current_exception());
+            throw;
+        }
+        const auto unpack_cost = chrono::steady_clock::now() - unpack_start;
+        if (!from_lower_tier) {
+            shard.stats.unpack_latency_us[GetLatencyBucket(unpack_cost)].fetch_add(1, memory_order_relaxed);
         }
 
-        free_space -= new_book_size;
-        cache.push_front(move(new_book));
-        storage[book_name] = cache.begin();
+        unique_lock lock = LockShard(shard);
+        shard.unpacking.erase(book_name);
+        // a book from a lower tier is priced by bringing it back from there, that is what missing it again costs first
+        shard.policy->Insert(book_name, new_book, unpack_cost);
+        shard.stats.evictions.store(shard.policy->GetEvictedCount(), memory_order_relaxed);
+        shard.stats.bytes_evicted.store(shard.policy->GetEvictedBytes(), memory_order_relaxed);
+        shard.stats.current_bytes.store(shard.policy->GetUsedMemory(), memory_order_relaxed);
+        shard.stats.entry_count.store(shard.policy->GetEntryCount(), memory_order_relaxed);
+        auto evicted = move(shard.evicted);
+        shard.evicted.clear();
+        for (const auto& [evicted_name, evicted_book] : evicted) {
+            shard.moving_down[evicted_name] = evicted_book;
+        }
+        lock.unlock();
+        unpacked.set_value(new_book);
 
-        return *storage[book_name];
+        if (!evicted.empty()) {
+            // off the reader's path, the reader has paid for its miss already
+            GetPool().Add([this, &shard, evicted = make_shared<vector<pair<string, BookPtr>>>(move(evicted))] {
+                MoveToLowerTiers(shard, *evicted);
+            });
+        }
+        return new_book;
+    }
+
+    // Both lower tiers get every evicted book, the compressed one is searched first.
+    // Compressing and writing happen outside the shard lock.
+    void MoveToLowerTiers(Shard& shard, const vector<pair<string, BookPtr>>& evicted) {
+        vector<string> compressed;
+        if (has_compressed_tier_) {
+            compressed.reserve(evicted.size());
+            for (const auto& [book_name, book] : evicted) {
+                compressed.push_back(Lz::Compress(book->GetContentView()));
+            }
+        }
+        if (spill_) {
+            for (const auto& [book_name, book] : evicted) {
+                try {
+                    spill_->Add(book_name, book->GetContentView());
+                }
+                catch (const exception&) {
+                    // a full or broken disk only costs the book its copy there
+                }
+            }
+        }
+
+        unique_lock lock = LockShard(shard);
+        for (size_t i = 0; i < evicted.size(); ++i) {
+            // a reader may have taken it back meanwhile, maybe it was even evicted again since
+            auto it = shard.moving_down.find(evicted[i].first);
+            if (it != shard.moving_down.end() && it->second == evicted[i].second) {
+                shard.moving_down.erase(it);
+                if (has_compressed_tier_) {
+                    shard.compressed.Insert(evicted[i].first, move(compressed[i]));
+                }
+            }
+        }
+        UpdateCompressedStats(shard);
+        lock.unlock();
+
+        if (spill_) {
+            UpdateSpillStats();
+        }
+    }
+
+    ThreadPool& GetPool() {
+        call_once(pool_started_, [this] {
+            pool_ = make_unique<ThreadPool>(pool_thread_count_);
+        });
+        return *pool_;
+    }
+
+    void UpdateSpillStats() {
+        spill_bytes_.store(spill_->GetDiskUsage(), memory_order_relaxed);
+        spill_entry_count_.store(spill_->GetEntryCount(), memory_order_relaxed);
+        spill_compactions_.store(spill_->GetCompactionCount(), memory_order_relaxed);
+    }
+
+    // Caller holds shard.m
+    static void UpdateCompressedStats(Shard& shard) {
+        shard.stats.compressed_bytes.store(shard.compressed.GetUsedMemory(), memory_order_relaxed);
+        shard.stats.compressed_entry_count.store(shard.compressed.GetEntryCount(), memory_order_relaxed);
+    }
+
+    // Looks the books up taking every shard lock once and queues the misses nobody unpacks yet on the pool
+    vector<BookHandle> StartBatch(const vector<string>& book_names, bool is_prefetch) {
+        // positions in book_names grouped by shard with a counting sort, so every shard is locked once
+        vector<size_t> shard_indices(book_names.size());
+        vector<size_t> group_ends(shards_.size() + 1);
+        for (size_t i = 0; i < book_names.size(); ++i) {
+            shard_indices[i] = GetShardIndex(book_names[i]);
+            ++group_ends[shard_indices[i] + 1];
+        }
+        partial_sum(group_ends.begin(), group_ends.end(), group_ends.begin());
+        vector<size_t> order(book_names.size());
+        {
+            vector<size_t> next(group_ends.begin(), group_ends.end() - 1);
+            for (size_t i = 0; i < book_names.size(); ++i) {
+                order[next[shard_indices[i]]++] = i;
+            }
+        }
+
+        struct PendingUnpack {
+            Shard* shard;
+            const string* book_name;
+            shared_ptr<promise<BookPtr>> unpacked;  // std::function needs a copyable task
+        };
+        vector<PendingUnpack> pending;
+        vector<BookHandle> result(is_prefetch ? 0 : book_names.size());
+        for (size_t shard_idx = 0; shard_idx < shards_.size(); ++shard_idx) {
+            if (group_ends[shard_idx] == group_ends[shard_idx + 1]) {
+                continue;
+            }
+            Shard& shard = shards_[shard_idx];
+            unique_lock lock = LockShard(shard);
+            for (size_t order_idx = group_ends[shard_idx]; order_idx < group_ends[shard_idx + 1]; ++order_idx) {
+                const size_t i = order[order_idx];
+                const string& book_name = book_names[i];
+                if (BookPtr book = shard.policy->Find(book_name)) {
+                    if (!is_prefetch) {
+                        AddLocked(shard.stats.hits, size_t(1));
+                        result[i].book = move(book);
+                    }
+                    continue;
+                }
+                if (!is_prefetch) {
+                    AddLocked(shard.stats.misses, size_t(1));
+                }
+                if (auto unpacking_it = shard.unpacking.find(book_name); unpacking_it != shard.unpacking.end()) {
+                    if (!is_prefetch) {
+                        result[i].unpacking = unpacking_it->second;
+                    }
+                    continue;
+                }
+                if (is_prefetch) {
+                    AddLocked(shard.stats.prefetches, size_t(1));
+                }
+                auto unpacked = make_shared<promise<BookPtr>>();
+                auto book_future = shard.unpacking.emplace(book_name, unpacked->get_future().share()).first->second;
+                if (!is_prefetch) {
+                    result[i].unpacking = move(book_future);
+                }
+                pending.push_back({&shard, &book_name, move(unpacked)});
+            }
+        }
+
+        if (!pending.empty()) {
+            ThreadPool& pool = GetPool();
+            for (auto& [shard, book_name, unpacked] : pending) {
+                pool.Add([this, shard = shard, book_name = *book_name, unpacked = move(unpacked)] {
+                    try {
+                        Unpack(*shard, book_name, *unpacked);
+                    }
+                    catch (...) {
+                        // the readers get the exception from the future
+                    }
+                });
+            }
+        }
+        return result;
     }
 };
 
 
 unique_ptr<ICache> MakeCache(shared_ptr<IBooksUnpacker> books_unpacker, const ICache::Settings& settings) {
 
-    return make_unique<LruCache>(move(books_unpacker), settings);
-}
\ No newline at end of file
+    return make_unique<ShardedCache>(move(books_unpacker), settings);
+}
+
+
+void PrintStatsJson(ostream& out, const ICache::Stats& stats) {
+    out << "{\"hits\": " << stats.hits
+        << ", \"misses\": " << stats.misses
+        << ", \"evictions\": " << stats.evictions
+        << ", \"bytes_evicted\": " << stats.bytes_evicted
+        << ", \"current_bytes\": " << stats.current_bytes
+        << ", \"entry_count\": " << stats.entry_count
+        << ", \"prefetches\": " << stats.prefetches
+        << ", \"pending_hits\": " << stats.pending_hits
+        << ", \"compressed_hits\": " << stats.compressed_hits
+        << ", \"compressed_bytes\": " << stats.compressed_bytes
+        << ", \"compressed_entry_count\": " << stats.compressed_entry_count
+        << ", \"spill_hits\": " << stats.spill_hits
+        << ", \"spill_bytes\": " << stats.spill_bytes
+        << ", \"spill_entry_count\": " << stats.spill_entry_count
+        << ", \"spill_compactions\": " << stats.spill_compactions
+        << ", \"contended_locks\": " << stats.contended_locks
+        << ", \"lock_wait_ns\": " << stats.lock_wait.count()
+        << ", \"unpack_latency_us\": [";
+    // non-empty buckets only, each as its exclusive upper bound and count
+    bool first = true;
+    for (size_t i = 0; i < stats.unpack_latency_us.size(); ++i) {
+        if (stats.unpack_latency_us[i] == 0) {
+            continue;
+        }
+        out << (first ? "" : ", ") << "{\"below\": ";
+        if (i + 1 < stats.unpack_latency_us.size()) {
+            out << (size_t(1) << i);
+        }
+        else {
+            out << "null";
+        }
+        out << ", \"count\": " << stats.unpack_latency_us[i] << '}';
+        first = false;
+    }
+    out << "]}";
+}
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <iosfwd>
+#include <future>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 class IBook {
 public:
@@ -10,6 +16,12 @@ public:
   virtual const std::string& GetName() const = 0;
 
   virtual const std::string& GetContent() const = 0;
+
+  // The cache reads contents through this, so a book backed by something other than a string,
+  // such as a file mapping, does not have to copy itself into one
+  virtual std::string_view GetContentView() const {
+    return GetContent();
+  }
 };
 
 class IBooksUnpacker {
@@ -23,17 +35,120 @@ class ICache {
 public:
   struct Settings {
     size_t max_memory = 0;
+    // Independent LRU shards, each gets max_memory / shard_count.
+    // A book larger than one shard's share is never cached.
+    size_t shard_count = 1;
+
+    enum class Eviction {
+      LRU,
+      CLOCK,  // LRU approximation, a hit only sets a flag
+      ARC,  // adapts between recency and frequency using the history of evicted books
+      W_TINY_LFU,  // small LRU window plus frequency-based admission to the main space
+      GREEDY_DUAL_SIZE,  // keeps the books that cost the most unpack time per byte, ages the rest out
+    };
+    Eviction eviction = Eviction::LRU;
+
+    enum class Accounting {
+      CONTENT,  // only GetContent().size() of every book counts against the budgets
+      // Every heap block a cached book keeps alive: its buffers, control block and the cache's own nodes,
+      // plus the entries ARC keeps for the books it remembers. This is a model of glibc malloc and
+      // the libstdc++ layouts, not a measurement: the chunk rounding and the sizes of the control block
+      // and of a book object are written into it, other allocators and layouts make it drift.
+      // Arrays that grow by doubling and never shrink (index slots, the LRU node pool) are charged twice
+      // their element size per entry, so a cache keeps up to about 15% more or less than it is charged for,
+      // and one that once held many more, smaller books than it holds now keeps more spare capacity.
+      // Not charged at all: the W-TinyLFU frequency sketch, a fixed 16 KiB per shard, and the shard maps
+      // of books being unpacked and of evicted books on their way to a lower tier, which hold an entry
+      // only until that work is done.
+      EXACT,
+    };
+    Accounting accounting = Accounting::CONTENT;
+
+    // Background threads unpacking books for Prefetch and GetBooks and compressing evicted ones,
+    // started on first use
+    size_t background_thread_count = 2;
+
+    // Budget of the second tier keeping evicted books compressed, 0 turns it off.
+    // A miss found there is decompressed instead of unpacked and goes back to the first tier.
+    size_t compressed_memory = 0;
+
+    // Disk budget of the third tier, 0 turns it off. Evicted books are appended to segment files
+    // of about spill_segment_size bytes in spill_directory and served back through mmap.
+    // A cache started on a directory another one left picks up the books found there.
+    std::string spill_directory;
+    size_t spill_disk_budget = 0;
+    size_t spill_segment_size = 16 << 20;
   };
 
   using BookPtr = std::shared_ptr<const IBook>;
 
+  // A cached book, or the future of one still being unpacked
+  struct BookHandle {
+    BookPtr book;
+    std::shared_future<BookPtr> unpacking;
+
+    bool IsReady() const {
+      return book != nullptr;
+    }
+
+    // Waits for the unpack if needed, rethrows its exception
+    BookPtr Get() const {
+      return book ? book : unpacking.get();
+    }
+  };
+
+  // Totals since the cache was created. Counters are read without locking,
+  // so a snapshot taken under load may be off by the requests in flight.
+  struct Stats {
+    static const size_t LATENCY_BUCKET_COUNT = 24;
+
+    size_t hits = 0;
+    // includes readers that waited for somebody else's unpack of the same book
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t bytes_evicted = 0;
+    size_t current_bytes = 0;
+    size_t entry_count = 0;
+    // unpacks started by Prefetch, its lookups are not counted as hits or misses
+    size_t prefetches = 0;
+    // misses served by a book evicted moments ago and still on its way down to a lower tier
+    size_t pending_hits = 0;
+    // misses served by decompressing a book from the second tier
+    size_t compressed_hits = 0;
+    size_t compressed_bytes = 0;
+    size_t compressed_entry_count = 0;
+    // misses served from the disk tier
+    size_t spill_hits = 0;
+    // bytes of all records on disk, including the ones already taken back and not compacted yet
+    size_t spill_bytes = 0;
+    size_t spill_entry_count = 0;
+    size_t spill_compactions = 0;
+    // [0] counts unpacks under 1us, [i] the ones in [2^(i-1), 2^i) us, the last bucket everything longer
+    std::array<size_t, LATENCY_BUCKET_COUNT> unpack_latency_us = {};
+    // time spent waiting for shard locks held by other threads
+    size_t contended_locks = 0;
+    std::chrono::nanoseconds lock_wait{0};
+  };
+
 public:
   virtual ~ICache() = default;
 
-  virtual BookPtr GetBook(const std::string& book_name) = 0;
+  // Taking a string_view, so a caller without a std::string does not build one for a hit
+  virtual BookPtr GetBook(std::string_view book_name) = 0;
+
+  // Starts unpacking the books that are neither cached nor being unpacked, without waiting for them
+  virtual void Prefetch(const std::vector<std::string>& book_names) = 0;
+
+  // One handle per name, in the same order. Cached books come back ready,
+  // the rest are unpacked in the background like Prefetch does.
+  virtual std::vector<BookHandle> GetBooks(const std::vector<std::string>& book_names) = 0;
+
+  virtual Stats GetStats() const = 0;
 };
 
 std::unique_ptr<ICache> MakeCache(
     std::shared_ptr<IBooksUnpacker> books_unpacker,
     const ICache::Settings& settings
 );
+
+void PrintStatsJson(std::ostream& out, const ICache::Stats& stats);
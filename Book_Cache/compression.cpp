@@ -0,0 +1,206 @@
+#include "compression.h"
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+
+// Format: the decompressed size as a varint, then sequences of
+//   token: literal count in the high 4 bits, match length - MIN_MATCH in the low 4 bits,
+//          15 in either means the value continues in the following bytes, each adding up to 255
+//   literals
+//   2-byte little endian offset of the match, absent in the last sequence
+namespace Lz {
+    namespace {
+        const size_t MIN_MATCH = 4;
+        const size_t MAX_OFFSET = 65535;
+        const size_t HASH_BITS = 14;
+        // the last bytes are always literals, so matching never reads past the end
+        const size_t END_LITERALS = 5;
+
+        uint32_t Read32(const char* p) {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        size_t Hash(uint32_t sequence) {
+            return (sequence * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        char* WriteVarint(char* out, size_t value) {
+            while (value >= 0x80) {
+                *out++ = static_cast<char>((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+            *out++ = static_cast<char>(value);
+            return out;
+        }
+
+        char* WriteLength(char* out, size_t length) {
+            for (; length >= 255; length -= 255) {
+                *out++ = static_cast<char>(255);
+            }
+            *out++ = static_cast<char>(length);
+            return out;
+        }
+
+        char* WriteSequence(char* out, string_view literals, size_t match_length, size_t offset) {
+            const size_t literal_code = min<size_t>(literals.size(), 15);
+            const size_t match_code = match_length == 0 ? 0 : min<size_t>(match_length - MIN_MATCH, 15);
+            *out++ = static_cast<char>(literal_code << 4 | match_code);
+            if (literal_code == 15) {
+                out = WriteLength(out, literals.size() - 15);
+            }
+            memcpy(out, literals.data(), literals.size());
+            out += literals.size();
+            if (match_length == 0) {
+                return out;
+            }
+            *out++ = static_cast<char>(offset & 0xff);
+            *out++ = static_cast<char>(offset >> 8);
+            if (match_code == 15) {
+                out = WriteLength(out, match_length - MIN_MATCH - 15);
+            }
+            return out;
+        }
+
+        class Reader {
+        public:
+            explicit Reader(string_view data) : data_(data) {
+            }
+
+            bool AtEnd() const {
+                return pos_ == data_.size();
+            }
+
+            uint8_t ReadByte() {
+                if (AtEnd()) {
+                    throw runtime_error("truncated compressed data");
+                }
+                return static_cast<uint8_t>(data_[pos_++]);
+            }
+
+            size_t ReadVarint() {
+                size_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    const uint8_t byte = ReadByte();
+                    value |= static_cast<size_t>(byte & 0x7f) << shift;
+                    if (!(byte & 0x80)) {
+                        return value;
+                    }
+                }
+                throw runtime_error("bad size in compressed data");
+            }
+
+            size_t ReadLength(size_t code) {
+                if (code != 15) {
+                    return code;
+                }
+                size_t length = code;
+                uint8_t byte;
+                do {
+                    byte = ReadByte();
+                    length += byte;
+                } while (byte == 255);
+                return length;
+            }
+
+            string_view ReadBytes(size_t count) {
+                if (data_.size() - pos_ < count) {
+                    throw runtime_error("truncated compressed data");
+                }
+                pos_ += count;
+                return data_.substr(pos_ - count, count);
+            }
+
+        private:
+            string_view data_;
+            size_t pos_ = 0;
+        };
+    }
+
+    string Compress(string_view data) {
+        // worst case: all literals, plus their length bytes, the varint and the token
+        string out(data.size() + data.size() / 255 + 16, '\0');
+        char* out_pos = WriteVarint(out.data(), data.size());
+
+        vector<uint32_t> table(size_t(1) << HASH_BITS, 0);  // last position + 1 of every hashed sequence
+        size_t literal_start = 0;
+        size_t pos = 0;
+        while (pos + MIN_MATCH + END_LITERALS <= data.size()) {
+            const uint32_t sequence = Read32(data.data() + pos);
+            uint32_t& slot = table[Hash(sequence)];
+            const size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos + 1);
+            if (candidate == 0 || pos + 1 - candidate > MAX_OFFSET || Read32(data.data() + candidate - 1) != sequence) {
+                ++pos;
+                continue;
+            }
+
+            const size_t match_start = candidate - 1;
+            size_t match_length = MIN_MATCH;
+            while (pos + match_length + END_LITERALS < data.size()
+                   && data[match_start + match_length] == data[pos + match_length]) {
+                ++match_length;
+            }
+            out_pos = WriteSequence(out_pos, data.substr(literal_start, pos - literal_start),
+                                    match_length, pos - match_start);
+            pos += match_length;
+            literal_start = pos;
+        }
+        out_pos = WriteSequence(out_pos, data.substr(literal_start), 0, 0);
+        out.resize(out_pos - out.data());
+        // the buffer was sized for the worst case, the cache keeps the result for long
+        out.shrink_to_fit();
+        return out;
+    }
+
+    string Decompress(string_view compressed) {
+        Reader reader(compressed);
+        const size_t size = reader.ReadVarint();
+        // every input byte yields at most 255 * 16 output bytes, a larger size is a lie
+        if (size / (255 * 16) > compressed.size()) {
+            throw runtime_error("bad size in compressed data");
+        }
+        string out(size, '\0');
+        char* out_pos = out.data();
+        char* const out_end = out_pos + size;
+        while (!reader.AtEnd()) {
+            const uint8_t token = reader.ReadByte();
+            const string_view literals = reader.ReadBytes(reader.ReadLength(token >> 4));
+            if (static_cast<size_t>(out_end - out_pos) < literals.size()) {
+                throw runtime_error("compressed data does not match its size");
+            }
+            memcpy(out_pos, literals.data(), literals.size());
+            out_pos += literals.size();
+            if (reader.AtEnd()) {
+                break;
+            }
+
+            const size_t offset = reader.ReadByte() | static_cast<size_t>(reader.ReadByte()) << 8;
+            const size_t match_length = reader.ReadLength(token & 0xf) + MIN_MATCH;
+            if (offset == 0 || offset > static_cast<size_t>(out_pos - out.data())
+                || static_cast<size_t>(out_end - out_pos) < match_length) {
+                throw runtime_error("bad match in compressed data");
+            }
+            const char* from = out_pos - offset;
+            if (offset >= match_length) {
+                memcpy(out_pos, from, match_length);
+                out_pos += match_length;
+            }
+            else {
+                // the match overlaps the bytes it produces, a short period repeating
+                for (size_t i = 0; i < match_length; ++i) {
+                    *out_pos++ = from[i];
+                }
+            }
+        }
+        if (out_pos != out_end) {
+            throw runtime_error("compressed data does not match its size");
+        }
+        return out;
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Byte-oriented LZ77 in the spirit of LZ4: literals and back references of at least 4 bytes
+// within the last 64 KiB, no entropy coding. Favours speed over ratio.
+namespace Lz {
+    std::string Compress(std::string_view data);
+
+    // Throws std::runtime_error on input that Compress could not have produced
+    std::string Decompress(std::string_view compressed);
+}
@@ -0,0 +1,659 @@
+#include "eviction.h"
+#include "name_index.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+namespace {
+    using BookPtr = ICache::BookPtr;
+
+    struct Entry {
+        string name;
+        BookPtr book;  // null for the evicted books ARC remembers
+        size_t size = 0;
+        bool referenced = false;  // CLOCK only
+    };
+
+    // shared_ptr made from the unique_ptr an unpacker returns: vtable pointer, two counters, the pointer
+    const size_t CONTROL_BLOCK_SIZE = 2 * sizeof(void*) + 2 * sizeof(int);
+    // an IBook holding its name and content, like every implementation in this project
+    const size_t BOOK_OBJECT_SIZE = sizeof(void*) + 2 * sizeof(string);
+
+    // Heap bytes of an entry kept in a std::list and indexed by name in a NameIndex holding Value:
+    // both copies of the name, the list node and the entry's share of the slot array
+    template <typename Value>
+    size_t GetIndexedListEntrySize(const string& book_name) {
+        return 2 * GetHeapSize(book_name) + GetAllocatedSize(2 * sizeof(void*) + sizeof(Entry))
+            + NameIndex<Value>::AVERAGE_ENTRY_SIZE;
+    }
+
+
+    // Nodes sit in one pool and link to each other by position, so a hit moves its node to the front
+    // by rewriting a few indices and a new book takes over the node of the one it evicted
+    class LruPolicy : public IEvictionPolicy {
+    public:
+        explicit LruPolicy(size_t max_memory) : max_memory_(max_memory) {
+        }
+
+        BookPtr Find(string_view book_name) override {
+            const uint32_t* node_idx = index_.Find(book_name);
+            if (node_idx == nullptr) {
+                return nullptr;
+            }
+            if (*node_idx != head_) {
+                Unlink(*node_idx);
+                PushFront(*node_idx);
+            }
+            return nodes_[*node_idx].book;
+        }
+
+        void Insert(const string& book_name, BookPtr book, chrono::nanoseconds) override {
+            const size_t size = GetCharge(book_name, book);
+            if (size > max_memory_ || index_.Contains(book_name)) {
+                return;
+            }
+            while (used_memory_ + size > max_memory_) {
+                const uint32_t victim = tail_;
+                Node& node = nodes_[victim];
+                CountEviction(node.name, node.book, node.size);
+                used_memory_ -= node.size;
+                index_.Erase(node.name);
+                Unlink(victim);
+                node.book = nullptr;
+                string().swap(node.name);
+                node.next = free_;
+                free_ = victim;
+            }
+
+            uint32_t node_idx = free_;
+            if (node_idx != NIL) {
+                free_ = nodes_[node_idx].next;
+            }
+            else {
+                node_idx = static_cast<uint32_t>(nodes_.size());
+                nodes_.emplace_back();
+            }
+            Node& node = nodes_[node_idx];
+            node.name = book_name;
+            node.book = move(book);
+            node.size = size;
+            PushFront(node_idx);
+            index_.Insert(book_name, node_idx);
+            used_memory_ += size;
+        }
+
+        size_t GetUsedMemory() const override {
+            return used_memory_;
+        }
+
+        size_t GetEntryCount() const override {
+            return index_.Size();
+        }
+
+    protected:
+        size_t GetNodesSize(const string& book_name) const override {
+            // the name in the node and in the index. The pool doubles and never shrinks, like the index slots,
+            // so an entry is charged two nodes to cover the spare capacity
+            return 2 * GetHeapSize(book_name) + 2 * sizeof(Node) + NameIndex<uint32_t>::AVERAGE_ENTRY_SIZE;
+        }
+
+    private:
+        static constexpr uint32_t NIL = UINT32_MAX;
+
+        struct Node {
+            string name;
+            BookPtr book;
+            size_t size = 0;
+            uint32_t prev = NIL;
+            uint32_t next = NIL;  // the next free node while the node is free
+        };
+
+        size_t max_memory_;
+        size_t used_memory_ = 0;
+        vector<Node> nodes_;
+        uint32_t head_ = NIL;  // most recent
+        uint32_t tail_ = NIL;
+        uint32_t free_ = NIL;
+        NameIndex<uint32_t> index_;
+
+        void Unlink(uint32_t node_idx) {
+            Node& node = nodes_[node_idx];
+            (node.prev != NIL ? nodes_[node.prev].next : head_) = node.next;
+            (node.next != NIL ? nodes_[node.next].prev : tail_) = node.prev;
+        }
+
+        void PushFront(uint32_t node_idx) {
+            Node& node = nodes_[node_idx];
+            node.prev = NIL;
+            node.next = head_;
+            (head_ != NIL ? nodes_[head_].prev : tail_) = node_idx;
+            head_ = node_idx;
+        }
+    };
+
+
+    // Books sit on a ring, a hit only sets the referenced flag. To free memory the hand sweeps the ring,
+    // clears flags it meets and evicts the first book that was not referenced since the last sweep.
+    class ClockPolicy : public IEvictionPolicy {
+    public:
+        explicit ClockPolicy(size_t max_memory) : max_memory_(max_memory), hand_(ring_.end()) {
+        }
+
+        BookPtr Find(string_view book_name) override {
+            const auto* it = index_.Find(book_name);
+            if (it == nullptr) {
+                return nullptr;
+            }
+            (*it)->referenced = true;
+            return (*it)->book;
+        }
+
+        void Insert(const string& book_name, BookPtr book, chrono::nanoseconds) override {
+            const size_t size = GetCharge(book_name, book);
+            if (size > max_memory_ || index_.Contains(book_name)) {
+                return;
+            }
+            while (used_memory_ + size > max_memory_) {
+                if (hand_ == ring_.end()) {
+                    hand_ = ring_.begin();
+                }
+                if (hand_->referenced) {
+                    hand_->referenced = false;
+                    ++hand_;
+                }
+                else {
+                    CountEviction(hand_->name, hand_->book, hand_->size);
+                    used_memory_ -= hand_->size;
+                    index_.Erase(hand_->name);
+                    hand_ = ring_.erase(hand_);
+                }
+            }
+            // just behind the hand, so the new book is the last one the next sweep looks at
+            index_.Insert(book_name, ring_.insert(hand_, {book_name, move(book), size}));
+            used_memory_ += size;
+        }
+
+        size_t GetUsedMemory() const override {
+            return used_memory_;
+        }
+
+        size_t GetEntryCount() const override {
+            return ring_.size();
+        }
+
+    protected:
+        size_t GetNodesSize(const string& book_name) const override {
+            return GetIndexedListEntrySize<list<Entry>::iterator>(book_name);
+        }
+
+    private:
+        size_t max_memory_;
+        size_t used_memory_ = 0;
+        list<Entry> ring_;
+        list<Entry>::iterator hand_;
+        NameIndex<list<Entry>::iterator> index_;
+    };
+
+
+    // Adaptive Replacement Cache with sizes in bytes instead of entries.
+    // T1 holds books seen once recently, T2 books seen at least twice. B1 and B2 remember
+    // names evicted from T1 and T2: a miss that hits B1 means T1 was too small and moves
+    // the target size of T1 up, a miss that hits B2 moves it down.
+    // The sizes in B1 and B2 are those of the evicted books and only steer the adaptation,
+    // what the remembered entries themselves take is charged as history_memory_.
+    class ArcPolicy : public IEvictionPolicy {
+    public:
+        explicit ArcPolicy(size_t max_memory) : max_memory_(max_memory) {
+        }
+
+        BookPtr Find(string_view book_name) override {
+            Location* location = index_.Find(book_name);
+            if (location == nullptr || IsGhost(location->segment)) {
+                return nullptr;
+            }
+            Move(*location, T2);
+            return location->it->book;
+        }
+
+        void Insert(const string& book_name, BookPtr book, chrono::nanoseconds) override {
+            const size_t size = GetCharge(book_name, book);
+            if (size > max_memory_) {
+                return;
+            }
+
+            const Location* location = index_.Find(book_name);
+            if (location != nullptr && !IsGhost(location->segment)) {
+                return;
+            }
+            if (location != nullptr && location->segment == B1) {
+                const size_t delta = max<size_t>(1, bytes_[B2] / max<size_t>(1, bytes_[B1])) * size;
+                target_t1_ = min(max_memory_, target_t1_ + delta);
+                Forget(book_name);
+                Replace(size, false);
+                Add(book_name, move(book), size, T2);
+            }
+            else if (location != nullptr && location->segment == B2) {
+                const size_t delta = max<size_t>(1, bytes_[B1] / max<size_t>(1, bytes_[B2])) * size;
+                target_t1_ = target_t1_ > delta ? target_t1_ - delta : 0;
+                Forget(book_name);
+                Replace(size, true);
+                Add(book_name, move(book), size, T2);
+            }
+            else {
+                // a new book: T1 and its history together stay within max_memory
+                while (bytes_[T1] + bytes_[B1] + size > max_memory_ && !lists_[B1].empty()) {
+                    Forget(lists_[B1].back().name);
+                }
+                Replace(size, false);
+                Add(book_name, move(book), size, T1);
+            }
+
+            // the history never describes more than max_memory bytes of books
+            while (bytes_[B1] + bytes_[B2] > max_memory_) {
+                const Segment ghost = bytes_[B1] >= bytes_[B2] ? B1 : B2;
+                Forget(lists_[ghost].back().name);
+            }
+        }
+
+        size_t GetUsedMemory() const override {
+            return bytes_[T1] + bytes_[T2] + history_memory_;
+        }
+
+        size_t GetEntryCount() const override {
+            return lists_[T1].size() + lists_[T2].size();
+        }
+
+    protected:
+        size_t GetNodesSize(const string& book_name) const override {
+            return GetIndexedListEntrySize<Location>(book_name);
+        }
+
+    private:
+        enum Segment { T1, T2, B1, B2, SEGMENT_COUNT };
+
+        struct Location {
+            Segment segment;
+            list<Entry>::iterator it;
+        };
+
+        size_t max_memory_;
+        size_t target_t1_ = 0;
+        array<list<Entry>, SEGMENT_COUNT> lists_;  // most recent first
+        array<size_t, SEGMENT_COUNT> bytes_ = {};
+        size_t history_memory_ = 0;  // GetHistoryCharge of the entries in B1 and B2
+        NameIndex<Location> index_;
+
+        static bool IsGhost(Segment segment) {
+            return segment == B1 || segment == B2;
+        }
+
+        void Move(Location& location, Segment segment) {
+            bytes_[location.segment] -= location.it->size;
+            bytes_[segment] += location.it->size;
+            lists_[segment].splice(lists_[segment].begin(), lists_[location.segment], location.it);
+            location.segment = segment;
+        }
+
+        void Add(const string& book_name, BookPtr book, size_t size, Segment segment) {
+            lists_[segment].push_front({book_name, move(book), size});
+            bytes_[segment] += size;
+            index_.Insert(book_name, {segment, lists_[segment].begin()});
+        }
+
+        // book_name may be the name in the entry going away
+        void Forget(const string& book_name) {
+            const Location location = index_.At(book_name);
+            history_memory_ -= GetHistoryCharge(book_name);
+            index_.Erase(book_name);
+            bytes_[location.segment] -= location.it->size;
+            lists_[location.segment].erase(location.it);
+        }
+
+        // Evicts books into the history until size more bytes fit, forgets history once no book is left
+        void Replace(size_t size, bool hit_in_b2) {
+            while (GetUsedMemory() + size > max_memory_) {
+                if (lists_[T1].empty() && lists_[T2].empty()) {
+                    Forget(lists_[bytes_[B1] >= bytes_[B2] ? B1 : B2].back().name);
+                    continue;
+                }
+                const bool from_t1 = !lists_[T1].empty()
+                    && (bytes_[T1] > target_t1_ || (hit_in_b2 && bytes_[T1] >= target_t1_) || lists_[T2].empty());
+                const Segment segment = from_t1 ? T1 : T2;
+                Location& location = index_.At(lists_[segment].back().name);
+                CountEviction(location.it->name, location.it->book, location.it->size);
+                location.it->book = nullptr;
+                history_memory_ += GetHistoryCharge(location.it->name);
+                Move(location, from_t1 ? B1 : B2);
+            }
+        }
+    };
+
+
+    // Approximate access counts in 4 rows of saturating 4-bit counters.
+    // Counters are halved every SAMPLE_FACTOR * width increments, so old popularity fades.
+    class FrequencySketch {
+    public:
+        static const size_t SAMPLE_FACTOR = 10;
+
+        explicit FrequencySketch(size_t width) : width_(width), table_(ROW_COUNT * width) {
+        }
+
+        void Increment(size_t hash) {
+            for (size_t row = 0; row < ROW_COUNT; ++row) {
+                uint8_t& counter = table_[GetIndex(hash, row)];
+                if (counter < MAX_COUNT) {
+                    ++counter;
+                }
+            }
+            if (++additions_ >= SAMPLE_FACTOR * width_) {
+                for (uint8_t& counter : table_) {
+                    counter /= 2;
+                }
+                additions_ /= 2;
+            }
+        }
+
+        uint8_t Estimate(size_t hash) const {
+            uint8_t result = MAX_COUNT;
+            for (size_t row = 0; row < ROW_COUNT; ++row) {
+                result = min(result, table_[GetIndex(hash, row)]);
+            }
+            return result;
+        }
+
+    private:
+        static const size_t ROW_COUNT = 4;
+        static const uint8_t MAX_COUNT = 15;
+
+        size_t width_;  // a power of two
+        vector<uint8_t> table_;
+        size_t additions_ = 0;
+
+        size_t GetIndex(size_t hash, size_t row) const {
+            static const uint64_t SEEDS[ROW_COUNT] = {
+                0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0xd6e8feb86659fd93ull,
+            };
+            const uint64_t mixed = (static_cast<uint64_t>(hash) + row) * SEEDS[row];
+            return row * width_ + ((mixed >> 32) & (width_ - 1));
+        }
+    };
+
+
+    // W-TinyLFU: new books enter a small LRU window. A book leaving the window only gets into
+    // the main space if the sketch says it is requested more often than the book it would evict.
+    // The main space is a segmented LRU: probation for books admitted once, protected for books hit there.
+    class WTinyLfuPolicy : public IEvictionPolicy {
+    public:
+        // window takes 1% of the memory and protected 80% of the rest, as in the original paper
+        explicit WTinyLfuPolicy(size_t max_memory)
+            : max_memory_(max_memory)
+            , window_max_(max_memory / 100)
+            , protected_max_((max_memory - window_max_) / 5 * 4)
+            , sketch_(SKETCH_WIDTH)
+        {
+        }
+
+        BookPtr Find(string_view book_name) override {
+            sketch_.Increment(hasher_(book_name));
+            Location* location = index_.Find(book_name);
+            if (location == nullptr) {
+                return nullptr;
+            }
+            if (location->segment == PROBATION) {
+                Move(*location, PROTECTED);
+                while (bytes_[PROTECTED] > protected_max_) {
+                    Move(index_.At(lists_[PROTECTED].back().name), PROBATION);
+                }
+            }
+            else {
+                Move(*location, location->segment);
+            }
+            return location->it->book;
+        }
+
+        void Insert(const string& book_name, BookPtr book, chrono::nanoseconds) override {
+            const size_t size = GetCharge(book_name, book);
+            if (size > max_memory_ || index_.Contains(book_name)) {
+                return;
+            }
+            lists_[WINDOW].push_front({book_name, move(book), size});
+            bytes_[WINDOW] += size;
+            index_.Insert(book_name, {WINDOW, lists_[WINDOW].begin()});
+
+            // books pushed out of the window wait in probation as candidates,
+            // they only stay there if they win against the main space victims
+            deque<string> candidates;
+            while (bytes_[WINDOW] > window_max_) {
+                Location& location = index_.At(lists_[WINDOW].back().name);
+                candidates.push_back(location.it->name);
+                Move(location, PROBATION);
+            }
+            while (GetUsedMemory() > max_memory_) {
+                EvictOne(candidates);
+            }
+        }
+
+        size_t GetUsedMemory() const override {
+            return bytes_[WINDOW] + bytes_[PROBATION] + bytes_[PROTECTED];
+        }
+
+        size_t GetEntryCount() const override {
+            return index_.Size();
+        }
+
+    protected:
+        size_t GetNodesSize(const string& book_name) const override {
+            return GetIndexedListEntrySize<Location>(book_name);
+        }
+
+    private:
+        static const size_t SKETCH_WIDTH = 1 << 12;
+
+        enum Segment { WINDOW, PROBATION, PROTECTED, SEGMENT_COUNT };
+
+        struct Location {
+            Segment segment;
+            list<Entry>::iterator it;
+        };
+
+        size_t max_memory_;
+        size_t window_max_;
+        size_t protected_max_;
+        hash<string_view> hasher_;
+        FrequencySketch sketch_;
+        array<list<Entry>, SEGMENT_COUNT> lists_;  // most recent first
+        array<size_t, SEGMENT_COUNT> bytes_ = {};
+        NameIndex<Location> index_;
+
+        void Move(Location& location, Segment segment) {
+            bytes_[location.segment] -= location.it->size;
+            bytes_[segment] += location.it->size;
+            lists_[segment].splice(lists_[segment].begin(), lists_[location.segment], location.it);
+            location.segment = segment;
+        }
+
+        // book_name may be the name in the entry going away
+        void Evict(const string& book_name) {
+            const Location location = index_.At(book_name);
+            CountEviction(book_name, location.it->book, location.it->size);
+            index_.Erase(book_name);
+            bytes_[location.segment] -= location.it->size;
+            lists_[location.segment].erase(location.it);
+        }
+
+        // The oldest candidate and the least recent main space book duel, the one requested less often goes.
+        // Candidates sit at the front of probation in the order they came, so the victim is either not
+        // a candidate at all or the oldest one.
+        void EvictOne(deque<string>& candidates) {
+            Segment victim_segment = WINDOW;
+            if (!lists_[PROBATION].empty()) {
+                victim_segment = PROBATION;
+            }
+            else if (!lists_[PROTECTED].empty()) {
+                victim_segment = PROTECTED;
+            }
+            const string& victim = lists_[victim_segment].back().name;
+            if (candidates.empty()) {
+                Evict(victim);
+                return;
+            }
+
+            const string& candidate = candidates.front();
+            if (candidate == victim || sketch_.Estimate(hasher_(candidate)) > sketch_.Estimate(hasher_(victim))) {
+                if (candidate == victim) {
+                    candidates.pop_front();
+                }
+                Evict(victim);
+            }
+            else {
+                Evict(candidate);
+                candidates.pop_front();
+            }
+        }
+    };
+
+
+    // GreedyDual-Size: a book gets the priority clock + cost per byte when it comes in and on every hit.
+    // The lowest priority goes first and moves the clock up to it, so books nobody reads sink below
+    // the rising clock: cheap big ones leave first, yet expensive ones do not stay forever.
+    class GreedyDualSizePolicy : public IEvictionPolicy {
+    public:
+        explicit GreedyDualSizePolicy(size_t max_memory) : max_memory_(max_memory) {
+        }
+
+        BookPtr Find(string_view book_name) override {
+            Node* node = index_.Find(book_name);
+            if (node == nullptr) {
+                return nullptr;
+            }
+            // the tree node is reused, a hit allocates nothing
+            auto queue_node = queue_.extract(node->queue_it);
+            queue_node.key() = clock_ + node->cost_per_byte;
+            node->queue_it = queue_.insert(move(queue_node));
+            return node->book;
+        }
+
+        void Insert(const string& book_name, BookPtr book, chrono::nanoseconds unpack_cost) override {
+            const size_t size = GetCharge(book_name, book);
+            if (size > max_memory_ || index_.Contains(book_name)) {
+                return;
+            }
+            while (used_memory_ + size > max_memory_) {
+                const auto victim = queue_.begin();
+                clock_ = victim->first;
+                const Node& node = index_.At(victim->second);
+                CountEviction(victim->second, node.book, node.size);
+                used_memory_ -= node.size;
+                index_.Erase(victim->second);
+                queue_.erase(victim);
+            }
+
+            const double cost_per_byte = max<double>(1, unpack_cost.count()) / max<size_t>(1, size);
+            const auto queue_it = queue_.emplace(clock_ + cost_per_byte, book_name);
+            index_.Insert(book_name, Node{move(book), size, cost_per_byte, queue_it});
+            used_memory_ += size;
+        }
+
+        size_t GetUsedMemory() const override {
+            return used_memory_;
+        }
+
+        size_t GetEntryCount() const override {
+            return index_.Size();
+        }
+
+    protected:
+        size_t GetNodesSize(const string& book_name) const override {
+            // a red-black tree node: color, three links, the priority and the name
+            const size_t queue_node_size = 4 * sizeof(void*) + sizeof(double) + sizeof(string);
+            return 2 * GetHeapSize(book_name) + GetAllocatedSize(queue_node_size) + NameIndex<Node>::AVERAGE_ENTRY_SIZE;
+        }
+
+    private:
+        using Queue = multimap<double, string>;  // priority to name, the next victim first
+
+        struct Node {
+            BookPtr book;
+            size_t size = 0;
+            double cost_per_byte = 0;  // nanoseconds of unpacking per byte of memory
+            Queue::iterator queue_it;
+        };
+
+        size_t max_memory_;
+        size_t used_memory_ = 0;
+        double clock_ = 0;
+        Queue queue_;
+        NameIndex<Node> index_;
+    };
+}
+
+size_t GetAllocatedSize(size_t requested) {
+    // a size_t header, rounded up to the alignment of two size_t, four of them at least
+    const size_t alignment = 2 * sizeof(size_t);
+    return max(2 * alignment, (requested + sizeof(size_t) + alignment - 1) / alignment * alignment);
+}
+
+size_t GetHeapSize(const string& s) {
+    return GetStringHeapSize(s.capacity());
+}
+
+size_t GetStringHeapSize(size_t capacity) {
+    static const size_t inplace_capacity = string().capacity();
+    return capacity > inplace_capacity ? GetAllocatedSize(capacity + 1) : 0;
+}
+
+size_t GetHashNodeSize(size_t mapped_size) {
+    // next pointer, key, value and the cached hash, the bucket array has about one pointer per node
+    return GetAllocatedSize(sizeof(void*) + sizeof(string) + mapped_size + sizeof(size_t)) + sizeof(void*);
+}
+
+size_t GetListEntryOverhead(const string& book_name, size_t list_value_size, size_t mapped_size) {
+    return 2 * GetHeapSize(book_name) + GetAllocatedSize(2 * sizeof(void*) + list_value_size)
+        + GetHashNodeSize(mapped_size);
+}
+
+size_t IEvictionPolicy::GetHistoryCharge(const string& book_name) const {
+    return accounting_ == ICache::Settings::Accounting::CONTENT ? 0 : GetNodesSize(book_name);
+}
+
+size_t IEvictionPolicy::GetCharge(const string& book_name, const ICache::BookPtr& book) const {
+    // through the view, so a book served from the disk tier is not copied out of its mapping to be charged,
+    // the content is charged as a string without spare capacity
+    const size_t content_size = book->GetContentView().size();
+    if (accounting_ == ICache::Settings::Accounting::CONTENT) {
+        return content_size;
+    }
+    return GetStringHeapSize(content_size) + GetHeapSize(book->GetName())
+        + GetAllocatedSize(BOOK_OBJECT_SIZE) + GetAllocatedSize(CONTROL_BLOCK_SIZE)
+        + GetNodesSize(book_name);
+}
+
+unique_ptr<IEvictionPolicy> MakeEvictionPolicy(const ICache::Settings& settings, size_t max_memory) {
+    unique_ptr<IEvictionPolicy> policy;
+    switch (settings.eviction) {
+    case ICache::Settings::Eviction::CLOCK:
+        policy = make_unique<ClockPolicy>(max_memory);
+        break;
+    case ICache::Settings::Eviction::ARC:
+        policy = make_unique<ArcPolicy>(max_memory);
+        break;
+    case ICache::Settings::Eviction::W_TINY_LFU:
+        policy = make_unique<WTinyLfuPolicy>(max_memory);
+        break;
+    case ICache::Settings::Eviction::GREEDY_DUAL_SIZE:
+        policy = make_unique<GreedyDualSizePolicy>(max_memory);
+        break;
+    default:
+        policy = make_unique<LruPolicy>(max_memory);
+    }
+    policy->SetAccounting(settings.accounting);
+    return policy;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Decides which books stay in one cache shard. Implementations are not thread-safe,
+// the shard lock guards every call. All of them keep the total content size of
+// the books they hold within max_memory.
+class IEvictionPolicy {
+public:
+    virtual ~IEvictionPolicy() = default;
+
+    // The cached book or nullptr. Called once for every request, so a policy sees misses too.
+    virtual ICache::BookPtr Find(std::string_view book_name) = 0;
+
+    // Offers a book unpacked after a miss, the policy may evict others to make room or refuse to keep it.
+    // unpack_cost is how long bringing it in took, only cost-aware policies look at it.
+    virtual void Insert(const std::string& book_name, ICache::BookPtr book, std::chrono::nanoseconds unpack_cost) = 0;
+
+    virtual size_t GetUsedMemory() const = 0;
+
+    virtual size_t GetEntryCount() const = 0;
+
+    // Books dropped to make room since the policy was created
+    size_t GetEvictedCount() const {
+        return evicted_count_;
+    }
+
+    size_t GetEvictedBytes() const {
+        return evicted_bytes_;
+    }
+
+    using EvictionListener = std::function<void(const std::string& book_name, ICache::BookPtr book)>;
+
+    // Called under the shard lock for every book evicted from now on
+    void SetEvictionListener(EvictionListener listener) {
+        eviction_listener_ = std::move(listener);
+    }
+
+    void SetAccounting(ICache::Settings::Accounting accounting) {
+        accounting_ = accounting;
+    }
+
+protected:
+    // What keeping the book costs against max_memory. In EXACT accounting these are the heap blocks
+    // of the book and its control block plus GetNodesSize.
+    size_t GetCharge(const std::string& book_name, const ICache::BookPtr& book) const;
+
+    // Heap bytes of the policy's own bookkeeping for one book
+    virtual size_t GetNodesSize(const std::string& book_name) const = 0;
+
+    // What remembering an evicted book costs: GetNodesSize in EXACT accounting, nothing otherwise
+    size_t GetHistoryCharge(const std::string& book_name) const;
+
+    void CountEviction(const std::string& book_name, const ICache::BookPtr& book, size_t book_size) {
+        ++evicted_count_;
+        evicted_bytes_ += book_size;
+        if (eviction_listener_) {
+            eviction_listener_(book_name, book);
+        }
+    }
+
+private:
+    size_t evicted_count_ = 0;
+    size_t evicted_bytes_ = 0;
+    EvictionListener eviction_listener_;
+    ICache::Settings::Accounting accounting_ = ICache::Settings::Accounting::CONTENT;
+};
+
+std::unique_ptr<IEvictionPolicy> MakeEvictionPolicy(const ICache::Settings& settings, size_t max_memory);
+
+// Bytes glibc malloc takes for a block of the given size, with its header and alignment
+size_t GetAllocatedSize(size_t requested);
+
+// Heap bytes behind a string, nothing for the short ones stored inside the object
+size_t GetHeapSize(const std::string& s);
+
+// Same for a string of the given capacity
+size_t GetStringHeapSize(size_t capacity);
+
+// Heap bytes of an entry kept in a std::list and indexed by name in a std::unordered_map:
+// both copies of the name, the list node holding list_value_size and the hash node holding mapped_size
+size_t GetListEntryOverhead(const std::string& book_name, size_t list_value_size, size_t mapped_size);
+
+// Heap bytes of a std::unordered_map node with a string key, plus its share of the bucket array
+size_t GetHashNodeSize(size_t mapped_size);
@@ -1,14 +1,61 @@
-#include "Common.h"
+#include "common.h"
+#include "compression.h"
+#include "profile.h"
+#include "spill.h"
 #include "test_runner.h"
 
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <new>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <future>
+#include <malloc.h>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 
+// Every operator new of the test binary goes through here, so a test can count the allocations of a call
+// and the heap bytes they keep: glibc chunks, the usable size plus the size_t header
+atomic<size_t> allocation_count = 0;
+atomic<size_t> allocated_bytes = 0;
+
+size_t GetChunkSize(void* memory) {
+  return malloc_usable_size(memory) + sizeof(size_t);
+}
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, memory_order_relaxed);
+  if (void* memory = malloc(size == 0 ? 1 : size)) {
+    allocated_bytes.fetch_add(GetChunkSize(memory), memory_order_relaxed);
+    return memory;
+  }
+  throw bad_alloc();
+}
+
+// out of line, so GCC does not mistake the free below for one of a block operator new did not come from
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+  if (memory) {
+    allocated_bytes.fetch_sub(GetChunkSize(memory), memory_order_relaxed);
+  }
+  free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, size_t) noexcept {
+  operator delete(memory);
+}
+
 class Book : public IBook {
 public:
   Book(
@@ -60,11 +107,158 @@ public:
     return unpacked_books_count_;
   }
 
-private:
+protected:
   atomic<size_t> memory_used_by_books_ = 0;
   atomic<int> unpacked_books_count_ = 0;
 };
 
+// Sleeps for a configurable time in every UnpackBook and remembers how many unpacks overlapped.
+// A test can also hold unpacks at a gate, to see what the cache does while they are in progress.
+class SlowBooksUnpacker : public BooksUnpacker {
+public:
+  explicit SlowBooksUnpacker(chrono::milliseconds latency)
+    : latency_(latency)
+  {
+  }
+
+  unique_ptr<IBook> UnpackBook(const string& book_name) override {
+    {
+      unique_lock lock(gate_mutex_);
+      const int running = ++running_unpacks_;
+      for (int max_running = max_running_unpacks_;
+           running > max_running && !max_running_unpacks_.compare_exchange_weak(max_running, running);) {
+      }
+      gate_changed_.notify_all();
+      gate_changed_.wait(lock, [this] { return !closed_; });
+    }
+    this_thread::sleep_for(latency_);
+    --running_unpacks_;
+    if (book_name == failing_book_name_) {
+      throw runtime_error("cannot unpack " + book_name);
+    }
+    return BooksUnpacker::UnpackBook(book_name);
+  }
+
+  void SetFailingBook(string book_name) {
+    failing_book_name_ = move(book_name);
+  }
+
+  int GetMaxRunningUnpacks() const {
+    return max_running_unpacks_;
+  }
+
+  // Unpacks started from now on wait in UnpackBook until OpenGate
+  void CloseGate() {
+    lock_guard lock(gate_mutex_);
+    closed_ = true;
+  }
+
+  void OpenGate() {
+    lock_guard lock(gate_mutex_);
+    closed_ = false;
+    gate_changed_.notify_all();
+  }
+
+  // Waits until count unpacks are in UnpackBook at once. The timeout only keeps
+  // a broken cache from hanging the test, nothing is measured against it.
+  bool WaitForRunningUnpacks(int count) {
+    unique_lock lock(gate_mutex_);
+    return gate_changed_.wait_for(lock, 10s, [this, count] { return running_unpacks_ >= count; });
+  }
+
+private:
+  chrono::milliseconds latency_;
+  string failing_book_name_;
+  atomic<int> running_unpacks_ = 0;
+  atomic<int> max_running_unpacks_ = 0;
+  mutex gate_mutex_;
+  condition_variable gate_changed_;
+  bool closed_ = false;
+};
+
+// Books of prose-like text generated from the name: phrases of common words, the frequent ones far more
+// frequent than the rest, so they repeat within a book about as much as real text does
+class TextBooksUnpacker : public BooksUnpacker {
+public:
+  TextBooksUnpacker(size_t book_size, chrono::microseconds latency)
+    : book_size_(book_size)
+    , latency_(latency)
+  {
+  }
+
+  unique_ptr<IBook> UnpackBook(const string& book_name) override {
+    this_thread::sleep_for(latency_);
+    static const vector<string> phrases = MakePhrases();
+    static const auto phrase_weights = [] {
+      vector<double> weights(phrases.size());
+      for (size_t i = 0; i < weights.size(); ++i) {
+        weights[i] = 1.0 / (i + 1);
+      }
+      return weights;
+    }();
+    mt19937 gen(hash<string>()(book_name));
+    discrete_distribution<size_t> dis(phrase_weights.begin(), phrase_weights.end());
+    string content;
+    content.reserve(book_size_ + 64);
+    while (content.size() < book_size_) {
+      content += phrases[dis(gen)];
+      content += (gen() % 8 == 0) ? ".\n" : ", ";
+    }
+    ++unpacked_books_count_;
+    return make_unique<Book>(book_name, move(content), memory_used_by_books_);
+  }
+
+private:
+  size_t book_size_;
+  chrono::microseconds latency_;
+
+  static vector<string> MakePhrases() {
+    static const vector<string> words = {
+      "the", "of", "and", "to", "in", "he", "said", "was", "that", "his", "it", "with", "her", "had", "as",
+      "for", "you", "she", "on", "at", "not", "but", "be", "him", "they", "from", "all", "by", "which", "were",
+      "dragon", "castle", "letter", "night", "window", "garden", "captain", "silence", "morning", "river",
+      "old", "house", "door", "face", "little", "long", "hand", "eyes", "again", "never", "could", "would",
+    };
+    mt19937 gen(1);
+    vector<string> phrases(500);
+    for (auto& phrase : phrases) {
+      const size_t length = 2 + gen() % 5;
+      for (size_t i = 0; i < length; ++i) {
+        phrase += (i ? " " : "") + words[gen() % words.size()];
+      }
+    }
+    return phrases;
+  }
+};
+
+// Every book has its own size and unpack time, both picked by the test
+class CostlyBooksUnpacker : public BooksUnpacker {
+public:
+  using BookCost = pair<size_t, chrono::microseconds>;  // content size, unpack time
+
+  explicit CostlyBooksUnpacker(function<BookCost(const string&)> get_cost)
+    : get_cost_(move(get_cost))
+  {
+  }
+
+  unique_ptr<IBook> UnpackBook(const string& book_name) override {
+    const auto [size, latency] = get_cost_(book_name);
+    this_thread::sleep_for(latency);
+    total_latency_us_ += latency.count();
+    ++unpacked_books_count_;
+    return make_unique<Book>(book_name, string(size, '#'), memory_used_by_books_);
+  }
+
+  // the unpack time asked for, sleeping takes a bit longer
+  chrono::microseconds GetTotalLatency() const {
+    return chrono::microseconds(total_latency_us_);
+  }
+
+private:
+  function<BookCost(const string&)> get_cost_;
+  atomic<int64_t> total_latency_us_ = 0;
+};
+
 struct Library {
   vector<string> book_names;
   unordered_map<string, unique_ptr<IBook>> content;
@@ -129,13 +323,11 @@ void TestSmallCache(const Library& lib) {
 }
 
 
-void TestAsync(const Library& lib) {
+void RunAsyncTrials(const Library& lib, const ICache::Settings& settings) {
   static const int tasks_count = 10;
   static const int trials_count = 10000;
 
   auto unpacker = make_shared<BooksUnpacker>();
-  ICache::Settings settings;
-  settings.max_memory = lib.size_in_bytes - 1;
   auto cache = MakeCache(unpacker, settings);
 
   vector<future<void>> tasks;
@@ -163,7 +355,1167 @@ void TestAsync(const Library& lib) {
 }
 
 
-int main() {
+void TestAsync(const Library& lib) {
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes - 1;
+  RunAsyncTrials(lib, settings);
+}
+
+
+void TestShardedAsync(const Library& lib) {
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes - 1;
+  settings.shard_count = 4;
+  RunAsyncTrials(lib, settings);
+}
+
+
+void TestShardedMaxMemory(const Library& lib) {
+  auto unpacker = make_shared<BooksUnpacker>();
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes / 2;
+  settings.shard_count = 3;
+  auto cache = MakeCache(unpacker, settings);
+
+  for (int round = 0; round < 3; ++round) {
+    for (const auto& book_name : lib.book_names) {
+      ASSERT_EQUAL(cache->GetBook(book_name)->GetName(), book_name);
+      ASSERT(unpacker->GetMemoryUsedByBooks() <= settings.max_memory);
+    }
+  }
+}
+
+
+vector<string> MakeBookNames(size_t count) {
+  vector<string> names;
+  names.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    names.push_back("Book #" + to_string(i));
+  }
+  return names;
+}
+
+// Skewed like real reading: book i is requested with weight 1 / (i + 1)
+vector<size_t> MakeZipfTrace(size_t book_count, size_t length, unsigned seed) {
+  vector<double> weights(book_count);
+  for (size_t i = 0; i < book_count; ++i) {
+    weights[i] = 1.0 / (i + 1);
+  }
+  discrete_distribution<size_t> dis(weights.begin(), weights.end());
+  default_random_engine gen(seed);
+  vector<size_t> trace(length);
+  for (auto& book_idx : trace) {
+    book_idx = dis(gen);
+  }
+  return trace;
+}
+
+double MeasureHitRatio(const vector<string>& names, const vector<size_t>& trace, const ICache::Settings& settings) {
+  auto unpacker = make_shared<BooksUnpacker>();
+  auto cache = MakeCache(unpacker, settings);
+  for (const size_t book_idx : trace) {
+    cache->GetBook(names[book_idx]);
+  }
+  return 1.0 - static_cast<double>(unpacker->GetUnpackedBooksCount()) / trace.size();
+}
+
+
+void TestShardedHitRatio(const Library&) {
+  const auto names = MakeBookNames(2000);
+  const auto trace = MakeZipfTrace(names.size(), 100000, 42);
+  ICache::Settings settings;
+  // every book takes about 40 bytes, so a few hundred of them fit
+  settings.max_memory = 10000;
+
+  const double global_ratio = MeasureHitRatio(names, trace, settings);
+  for (const size_t shard_count : {4, 16}) {
+    settings.shard_count = shard_count;
+    const double sharded_ratio = MeasureHitRatio(names, trace, settings);
+    ostringstream hint;
+    hint << "global " << global_ratio << ", " << shard_count << " shards " << sharded_ratio;
+    Assert(abs(global_ratio - sharded_ratio) < 0.02, hint.str());
+  }
+}
+
+
+void TestSingleFlight(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(50ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  auto cache = MakeCache(unpacker, settings);
+
+  vector<future<ICache::BookPtr>> readers;
+  for (int i = 0; i < 8; ++i) {
+    readers.push_back(async(launch::async, [&cache, &lib] {
+      return cache->GetBook(lib.book_names[0]);
+    }));
+  }
+  for (auto& reader : readers) {
+    ASSERT_EQUAL(reader.get()->GetName(), lib.book_names[0]);
+  }
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), 1);
+}
+
+
+void TestParallelMisses(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(0ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  auto cache = MakeCache(unpacker, settings);
+
+  // all four misses get into the unpacker while none of them can finish
+  unpacker->CloseGate();
+  vector<future<void>> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.push_back(async(launch::async, [&cache, &lib, i] {
+      cache->GetBook(lib.book_names[i]);
+    }));
+  }
+  const bool all_running = unpacker->WaitForRunningUnpacks(4);
+  unpacker->OpenGate();
+  for (auto& reader : readers) {
+    reader.get();
+  }
+  ASSERT(all_running);
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), 4);
+  ASSERT_EQUAL(unpacker->GetMaxRunningUnpacks(), 4);
+}
+
+
+void TestHitDuringMiss(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(0ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  auto cache = MakeCache(unpacker, settings);
+  cache->GetBook(lib.book_names[0]);
+
+  // the miss stays in the unpacker until the hit is served
+  unpacker->CloseGate();
+  auto miss = async(launch::async, [&cache, &lib] {
+    cache->GetBook(lib.book_names[1]);
+  });
+  const bool miss_running = unpacker->WaitForRunningUnpacks(1);
+  auto hit = async(launch::async, [&cache, &lib] {
+    return cache->GetBook(lib.book_names[0])->GetName();
+  });
+  const bool hit_served = hit.wait_for(10s) == future_status::ready;
+  unpacker->OpenGate();
+  miss.get();
+  ASSERT(miss_running);
+  ASSERT(hit_served);
+  ASSERT_EQUAL(hit.get(), lib.book_names[0]);
+}
+
+
+void TestFailedUnpack(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(50ms);
+  unpacker->SetFailingBook(lib.book_names[0]);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  auto cache = MakeCache(unpacker, settings);
+
+  vector<future<ICache::BookPtr>> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.push_back(async(launch::async, [&cache, &lib] {
+      return cache->GetBook(lib.book_names[0]);
+    }));
+  }
+  for (auto& reader : readers) {
+    bool failed = false;
+    try {
+      reader.get();
+    } catch (const runtime_error&) {
+      failed = true;
+    }
+    ASSERT(failed);
+  }
+
+  // the failure is not cached, the next reader tries again
+  unpacker->SetFailingBook("");
+  ASSERT_EQUAL(cache->GetBook(lib.book_names[0])->GetName(), lib.book_names[0]);
+}
+
+
+const vector<ICache::Settings::Eviction> ALL_EVICTIONS = {
+  ICache::Settings::Eviction::LRU,
+  ICache::Settings::Eviction::CLOCK,
+  ICache::Settings::Eviction::ARC,
+  ICache::Settings::Eviction::W_TINY_LFU,
+  ICache::Settings::Eviction::GREEDY_DUAL_SIZE,
+};
+
+string_view GetEvictionName(ICache::Settings::Eviction eviction) {
+  switch (eviction) {
+  case ICache::Settings::Eviction::LRU:
+    return "LRU";
+  case ICache::Settings::Eviction::CLOCK:
+    return "CLOCK";
+  case ICache::Settings::Eviction::ARC:
+    return "ARC";
+  case ICache::Settings::Eviction::W_TINY_LFU:
+    return "W-TinyLFU";
+  case ICache::Settings::Eviction::GREEDY_DUAL_SIZE:
+    return "GreedyDual-Size";
+  }
+  return "?";
+}
+
+
+void TestEvictionMaxMemory(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes / 2;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+
+    for (int round = 0; round < 3; ++round) {
+      for (const auto& book_name : lib.book_names) {
+        ASSERT_EQUAL(cache->GetBook(book_name)->GetName(), book_name);
+        Assert(unpacker->GetMemoryUsedByBooks() <= settings.max_memory, string(GetEvictionName(eviction)));
+      }
+    }
+  }
+}
+
+
+void TestEvictionCaching(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+
+    for (int round = 0; round < 3; ++round) {
+      for (const auto& book_name : lib.book_names) {
+        cache->GetBook(book_name);
+      }
+    }
+    // everything fits, so every book is unpacked once whatever the policy
+    Assert(unpacker->GetUnpackedBooksCount() == static_cast<int>(lib.book_names.size()),
+           string(GetEvictionName(eviction)));
+  }
+}
+
+
+void TestEvictionSmallCache(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory =
+        unpacker->UnpackBook(lib.book_names[0])->GetContent().size() - 1;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+
+    cache->GetBook(lib.book_names[0]);
+    Assert(unpacker->GetMemoryUsedByBooks() == 0, string(GetEvictionName(eviction)));
+  }
+}
+
+
+void TestEvictionAsync(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes / 2;
+    settings.shard_count = 2;
+    settings.eviction = eviction;
+    RunAsyncTrials(lib, settings);
+  }
+}
+
+
+struct ReplayResult {
+  double hit_ratio = 0;
+  double ops_per_second = 0;
+  ICache::Stats stats;
+};
+
+ReplayResult ReplayTrace(const vector<string>& trace, const ICache::Settings& settings) {
+  auto unpacker = make_shared<BooksUnpacker>();
+  auto cache = MakeCache(unpacker, settings);
+  const auto start = chrono::steady_clock::now();
+  for (const auto& book_name : trace) {
+    cache->GetBook(book_name);
+  }
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return {
+    1.0 - static_cast<double>(unpacker->GetUnpackedBooksCount()) / trace.size(),
+    trace.size() / elapsed.count(),
+    cache->GetStats()
+  };
+}
+
+// Zipf reads of hot books, every scan_period requests interrupted by scan_length books read once and never again,
+// like a batch job going through the whole catalogue
+vector<string> MakeScanTrace(size_t book_count, size_t length, size_t scan_period, size_t scan_length, unsigned seed) {
+  const auto names = MakeBookNames(book_count);
+  const auto hot_trace = MakeZipfTrace(book_count, length, seed);
+  vector<string> trace;
+  size_t cold_book = 0;
+  for (size_t i = 0; i < hot_trace.size(); ++i) {
+    if (i % scan_period == 0) {
+      for (size_t j = 0; j < scan_length; ++j) {
+        trace.push_back("Cold book #" + to_string(cold_book++));
+      }
+    }
+    trace.push_back(names[hot_trace[i]]);
+  }
+  return trace;
+}
+
+
+void TestScanResistance(const Library&) {
+  const auto trace = MakeScanTrace(2000, 100000, 1000, 400, 42);
+  ICache::Settings settings;
+  settings.max_memory = 10000;
+
+  const double lru_ratio = ReplayTrace(trace, settings).hit_ratio;
+  for (const auto eviction : {ICache::Settings::Eviction::ARC, ICache::Settings::Eviction::W_TINY_LFU}) {
+    settings.eviction = eviction;
+    const double ratio = ReplayTrace(trace, settings).hit_ratio;
+    ostringstream hint;
+    hint << "LRU " << lru_ratio << ", " << GetEvictionName(eviction) << " " << ratio;
+    Assert(ratio > lru_ratio + 0.02, hint.str());
+  }
+}
+
+
+void TestStats(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes / 2;
+    settings.shard_count = 2;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+
+    size_t requests = 0;
+    for (int round = 0; round < 3; ++round) {
+      for (size_t i = 0; i < lib.book_names.size(); i += 1 + round % 2) {
+        cache->GetBook(lib.book_names[i]);
+        ++requests;
+      }
+    }
+
+    const auto stats = cache->GetStats();
+    const string hint(GetEvictionName(eviction));
+    const size_t unpacked = unpacker->GetUnpackedBooksCount();
+    Assert(stats.hits + stats.misses == requests, hint);
+    Assert(stats.misses == unpacked, hint);
+    // the cache owns the only references left
+    Assert(stats.current_bytes == unpacker->GetMemoryUsedByBooks(), hint);
+    Assert(stats.entry_count + stats.evictions == unpacked, hint);
+    Assert(stats.evictions > 0, hint);
+    Assert(stats.bytes_evicted > 0, hint);
+    Assert(accumulate(stats.unpack_latency_us.begin(), stats.unpack_latency_us.end(), size_t(0)) == unpacked, hint);
+    Assert(stats.contended_locks == 0 && stats.lock_wait.count() == 0, hint);
+  }
+}
+
+
+void TestStatsUnderLoad(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(1ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes / 2;
+  auto cache = MakeCache(unpacker, settings);
+
+  vector<future<void>> tasks;
+  for (int task_num = 0; task_num < 4; ++task_num) {
+    tasks.push_back(async(launch::async, [&cache, &lib, task_num] {
+      default_random_engine gen(task_num);
+      uniform_int_distribution<size_t> dis(0, lib.book_names.size() - 1);
+      for (int i = 0; i < 500; ++i) {
+        cache->GetBook(lib.book_names[dis(gen)]);
+      }
+    }));
+  }
+  for (auto& task : tasks) {
+    task.get();
+  }
+
+  const auto stats = cache->GetStats();
+  ASSERT_EQUAL(stats.hits + stats.misses, size_t(2000));
+  // misses coalesced on an unpack in flight are not unpacks
+  ASSERT(stats.misses >= static_cast<size_t>(unpacker->GetUnpackedBooksCount()));
+  const size_t timed_unpacks =
+      accumulate(stats.unpack_latency_us.begin(), stats.unpack_latency_us.end(), size_t(0));
+  ASSERT_EQUAL(timed_unpacks, static_cast<size_t>(unpacker->GetUnpackedBooksCount()));
+  // 1ms is 1000us, so nothing lands in the buckets below 512us
+  ASSERT_EQUAL(accumulate(stats.unpack_latency_us.begin(), stats.unpack_latency_us.begin() + 10, size_t(0)),
+               size_t(0));
+}
+
+
+void TestStatsJson(const Library& lib) {
+  auto unpacker = make_shared<BooksUnpacker>();
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  auto cache = MakeCache(unpacker, settings);
+  cache->GetBook(lib.book_names[0]);
+  cache->GetBook(lib.book_names[0]);
+
+  auto stats = cache->GetStats();
+  stats.unpack_latency_us = {};
+  stats.unpack_latency_us[3] = 1;
+  stats.unpack_latency_us.back() = 2;
+  stats.lock_wait = 1500ns;
+  ostringstream out;
+  PrintStatsJson(out, stats);
+  ASSERT_EQUAL(out.str(),
+      "{\"hits\": 1, \"misses\": 1, \"evictions\": 0, \"bytes_evicted\": 0, \"current_bytes\": "
+      + to_string(stats.current_bytes) + ", \"entry_count\": 1, \"prefetches\": 0, \"pending_hits\": 0, \"compressed_hits\": 0, \"compressed_bytes\": 0, "
+      "\"compressed_entry_count\": 0, \"spill_hits\": 0, \"spill_bytes\": 0, \"spill_entry_count\": 0, "
+      "\"spill_compactions\": 0, \"contended_locks\": 0, \"lock_wait_ns\": 1500"
+      ", \"unpack_latency_us\": [{\"below\": 8, \"count\": 1}, {\"below\": null, \"count\": 2}]}");
+}
+
+
+void TestPrefetch(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(50ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  settings.background_thread_count = 4;
+  auto cache = MakeCache(unpacker, settings);
+
+  const auto start = chrono::steady_clock::now();
+  cache->Prefetch(lib.book_names);
+  cache->Prefetch(lib.book_names);
+  ASSERT(chrono::steady_clock::now() - start < 20ms);
+
+  for (const auto& book_name : lib.book_names) {
+    ASSERT_EQUAL(cache->GetBook(book_name)->GetName(), book_name);
+  }
+  // the readers joined the prefetches, nobody unpacked twice
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), static_cast<int>(lib.book_names.size()));
+  ASSERT(unpacker->GetMaxRunningUnpacks() > 1);
+
+  const auto stats = cache->GetStats();
+  ASSERT_EQUAL(stats.prefetches, lib.book_names.size());
+  ASSERT_EQUAL(stats.hits + stats.misses, lib.book_names.size());
+}
+
+
+void TestGetBooks(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(50ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  settings.shard_count = 3;
+  auto cache = MakeCache(unpacker, settings);
+  cache->GetBook(lib.book_names[0]);
+
+  const vector<string> book_names = {lib.book_names[1], lib.book_names[0], lib.book_names[2], lib.book_names[1]};
+  auto books = cache->GetBooks(book_names);
+  ASSERT_EQUAL(books.size(), book_names.size());
+  ASSERT(books[1].IsReady());
+  ASSERT(!books[0].IsReady());
+  for (size_t i = 0; i < books.size(); ++i) {
+    ASSERT_EQUAL(books[i].Get()->GetName(), book_names[i]);
+  }
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), 3);
+
+  // all cached now
+  for (const auto& book : cache->GetBooks(book_names)) {
+    ASSERT(book.IsReady());
+  }
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), 3);
+}
+
+
+void TestGetBooksFailure(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(10ms);
+  unpacker->SetFailingBook(lib.book_names[0]);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  auto cache = MakeCache(unpacker, settings);
+
+  auto books = cache->GetBooks({lib.book_names[0], lib.book_names[1]});
+  bool failed = false;
+  try {
+    books[0].Get();
+  } catch (const runtime_error&) {
+    failed = true;
+  }
+  ASSERT(failed);
+  ASSERT_EQUAL(books[1].Get()->GetName(), lib.book_names[1]);
+
+  unpacker->SetFailingBook("");
+  ASSERT_EQUAL(cache->GetBook(lib.book_names[0])->GetName(), lib.book_names[0]);
+}
+
+
+void TestDestroyWhilePrefetching(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>(5ms);
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  settings.background_thread_count = 1;
+  vector<ICache::BookHandle> books;
+  {
+    auto cache = MakeCache(unpacker, settings);
+    books = cache->GetBooks(lib.book_names);
+  }
+  // the queued unpacks finish before the cache goes away
+  for (size_t i = 0; i < books.size(); ++i) {
+    ASSERT_EQUAL(books[i].Get()->GetName(), lib.book_names[i]);
+  }
+}
+
+
+void TestCompression(const Library&) {
+  vector<string> inputs = {"", "a", "abcd", "abcabcabcabcabcabcabcabcabcabc", string(100000, 'x')};
+  mt19937 gen(7);
+  string noise;
+  for (int i = 0; i < 70000; ++i) {
+    noise.push_back(static_cast<char>(gen()));
+  }
+  inputs.push_back(noise);
+  inputs.push_back(TextBooksUnpacker(200000, 0us).UnpackBook("War and Peace")->GetContent());
+
+  for (const auto& input : inputs) {
+    const string compressed = Lz::Compress(input);
+    ASSERT(Lz::Decompress(compressed) == input);
+  }
+  ASSERT(Lz::Compress(inputs[4]).size() < 1000);
+  ASSERT(Lz::Compress(inputs.back()).size() < inputs.back().size() / 2);
+
+  const string compressed = Lz::Compress(inputs.back().substr(0, 5000));
+  for (size_t cut : {size_t(1), compressed.size() / 2, compressed.size() - 1}) {
+    bool failed = false;
+    try {
+      Lz::Decompress(compressed.substr(0, cut));
+    } catch (const runtime_error&) {
+      failed = true;
+    }
+    ASSERT(failed);
+  }
+}
+
+
+void TestCompressedTier(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes / 4;
+    settings.compressed_memory = lib.size_in_bytes * 2;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+
+    for (int round = 0; round < 3; ++round) {
+      for (size_t i = 0; i < lib.book_names.size(); ++i) {
+        const auto& book_name = lib.book_names[i];
+        ASSERT_EQUAL(cache->GetBook(book_name)->GetContent(), lib.content.at(book_name)->GetContent());
+        // let the evicted books reach the second tier, otherwise the next miss may still find them on the way
+        const size_t seen_count = round == 0 ? i + 1 : lib.book_names.size();
+        for (int attempt = 0; attempt < 1000; ++attempt) {
+          const auto stats = cache->GetStats();
+          if (stats.compressed_entry_count + stats.entry_count == seen_count) {
+            break;
+          }
+          this_thread::sleep_for(1ms);
+        }
+      }
+    }
+
+    const auto stats = cache->GetStats();
+    const string hint(GetEvictionName(eviction));
+    // the second tier holds everything evicted, so nothing is unpacked twice
+    Assert(unpacker->GetUnpackedBooksCount() == static_cast<int>(lib.book_names.size()), hint);
+    Assert(stats.pending_hits + stats.compressed_hits == stats.misses - lib.book_names.size(), hint);
+    Assert(stats.compressed_hits > 0, hint);
+    Assert(stats.current_bytes <= settings.max_memory, hint);
+    // the evicted books still being compressed are in neither count
+    Assert(stats.compressed_entry_count + stats.entry_count <= lib.book_names.size(), hint);
+  }
+}
+
+
+void TestCompressedTierBudget(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes / 4;
+    settings.compressed_memory = lib.size_in_bytes / 3;
+    settings.shard_count = 2;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+
+    for (int round = 0; round < 3; ++round) {
+      for (const auto& book_name : lib.book_names) {
+        ASSERT_EQUAL(cache->GetBook(book_name)->GetContent(), lib.content.at(book_name)->GetContent());
+        const auto stats = cache->GetStats();
+        Assert(stats.compressed_bytes <= settings.compressed_memory, string(GetEvictionName(eviction)));
+      }
+    }
+  }
+
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes / 3;
+  settings.compressed_memory = lib.size_in_bytes / 3;
+  settings.shard_count = 2;
+  RunAsyncTrials(lib, settings);
+}
+
+
+void TestExactAccounting(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    size_t cached_books[2];
+    for (const auto accounting : {ICache::Settings::Accounting::CONTENT, ICache::Settings::Accounting::EXACT}) {
+      auto unpacker = make_shared<BooksUnpacker>();
+      ICache::Settings settings;
+      settings.max_memory = lib.size_in_bytes;
+      settings.eviction = eviction;
+      settings.accounting = accounting;
+      auto cache = MakeCache(unpacker, settings);
+
+      for (int round = 0; round < 2; ++round) {
+        for (const auto& book_name : lib.book_names) {
+          ASSERT_EQUAL(cache->GetBook(book_name)->GetName(), book_name);
+        }
+      }
+      const auto stats = cache->GetStats();
+      const string hint(GetEvictionName(eviction));
+      Assert(stats.current_bytes <= settings.max_memory, hint);
+      if (accounting == ICache::Settings::Accounting::EXACT) {
+        // names, nodes and control blocks take about as much as this short content
+        Assert(stats.current_bytes > unpacker->GetMemoryUsedByBooks() * 2, hint);
+      }
+      cached_books[accounting == ICache::Settings::Accounting::EXACT] = stats.entry_count;
+    }
+    Assert(cached_books[1] < cached_books[0], string(GetEvictionName(eviction)));
+  }
+
+  // What the cache keeps on the heap, counted by operator new, is what it charges. The index slots and
+  // the LRU node pool double and are charged two elements per entry, so depending on how full they are
+  // the cache keeps up to 15% more or less than it is charged for: the budgets below land on both sides.
+  const auto names = MakeBookNames(2000);
+  for (const auto eviction : ALL_EVICTIONS) {
+    for (const size_t max_memory : {75'000, 130'000}) {
+      auto unpacker = make_shared<BooksUnpacker>();
+      ICache::Settings settings;
+      settings.max_memory = max_memory;
+      settings.eviction = eviction;
+      settings.accounting = ICache::Settings::Accounting::EXACT;
+      auto cache = MakeCache(unpacker, settings);
+
+      const size_t bytes_before = allocated_bytes.load();
+      mt19937 gen(7);
+      uniform_int_distribution<size_t> book_idx(0, names.size() - 1);
+      for (int i = 0; i < 20000; ++i) {
+        cache->GetBook(names[book_idx(gen)]);
+      }
+      const size_t kept = allocated_bytes.load() - bytes_before;
+      const size_t charged = cache->GetStats().current_bytes;
+      const string hint = string(GetEvictionName(eviction)) + ": kept " + to_string(kept)
+        + " bytes, charged " + to_string(charged);
+      Assert(kept > 0.8 * charged && kept < 1.2 * charged, hint);
+    }
+  }
+}
+
+
+void TestGreedyDualSizeKeepsExpensive(const Library&) {
+  // six books of the same size, the first three take 10ms to unpack and the rest nothing; four fit
+  const auto names = MakeBookNames(6);
+  const auto get_cost = [](const string& book_name) {
+    return CostlyBooksUnpacker::BookCost{1000, book_name < "Book #3" ? 10ms : 0ms};
+  };
+
+  auto measure = [&names, &get_cost](ICache::Settings::Eviction eviction) {
+    auto unpacker = make_shared<CostlyBooksUnpacker>(get_cost);
+    ICache::Settings settings;
+    settings.max_memory = 4000;
+    settings.eviction = eviction;
+    auto cache = MakeCache(unpacker, settings);
+    for (int round = 0; round < 5; ++round) {
+      for (const auto& book_name : names) {
+        cache->GetBook(book_name);
+      }
+    }
+    return unpacker->GetTotalLatency();
+  };
+
+  // a loop over twice the capacity makes LRU miss every time
+  ASSERT_EQUAL(measure(ICache::Settings::Eviction::LRU).count(), (150ms).count() * 1000);
+  // the expensive books are unpacked once, the cheap ones take turns in the fourth slot
+  ASSERT_EQUAL(measure(ICache::Settings::Eviction::GREEDY_DUAL_SIZE).count(), (30ms).count() * 1000);
+}
+
+
+void TestHitAllocatesNothing(const Library& lib) {
+  // names longer than 15 chars live on the heap, a lookup building a std::string would allocate for them
+  const vector<string_view> book_names(lib.book_names.begin(), lib.book_names.end());
+  for (const auto eviction : ALL_EVICTIONS) {
+    for (const size_t shard_count : {1, 4}) {
+      ICache::Settings settings;
+      settings.max_memory = lib.size_in_bytes * 2;
+      settings.shard_count = shard_count;
+      settings.eviction = eviction;
+      auto cache = MakeCache(make_shared<BooksUnpacker>(), settings);
+      for (const auto& book_name : lib.book_names) {
+        cache->GetBook(book_name);
+      }
+      const string hint = string(GetEvictionName(eviction)) + ", shards " + to_string(shard_count);
+
+      // ASSERT builds a message every time, so the results are checked after the loop
+      size_t books_found = 0;
+      const size_t allocations_before = allocation_count.load(memory_order_relaxed);
+      for (int round = 0; round < 10; ++round) {
+        for (const string_view book_name : book_names) {
+          books_found += cache->GetBook(book_name) != nullptr;
+        }
+      }
+      const size_t allocations = allocation_count.load(memory_order_relaxed) - allocations_before;
+      Assert(allocations == 0, hint);
+      Assert(books_found == 10 * book_names.size(), hint);
+      Assert(cache->GetStats().hits == 10 * book_names.size(), hint);
+    }
+  }
+}
+
+
+// A fresh directory under the system temp one, removed with everything in it
+class TempDirectory {
+public:
+  TempDirectory() {
+    string path_template = (filesystem::temp_directory_path() / "book_cache_XXXXXX").string();
+    if (mkdtemp(path_template.data()) == nullptr) {
+      throw runtime_error("cannot create a temp directory");
+    }
+    path_ = move(path_template);
+  }
+
+  ~TempDirectory() {
+    error_code error;
+    filesystem::remove_all(path_, error);
+  }
+
+  const string& GetPath() const {
+    return path_;
+  }
+
+  vector<filesystem::path> GetFiles() const {
+    vector<filesystem::path> files;
+    for (const auto& entry : filesystem::directory_iterator(path_)) {
+      files.push_back(entry.path());
+    }
+    sort(files.begin(), files.end());
+    return files;
+  }
+
+private:
+  string path_;
+};
+
+
+void TestSpillTier(const Library& lib) {
+  for (const auto eviction : ALL_EVICTIONS) {
+    TempDirectory directory;
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = lib.size_in_bytes / 4;
+    settings.eviction = eviction;
+    settings.spill_directory = directory.GetPath();
+    settings.spill_disk_budget = 1 << 20;
+    settings.spill_segment_size = 256;
+    auto cache = MakeCache(unpacker, settings);
+
+    for (int round = 0; round < 3; ++round) {
+      for (const auto& book_name : lib.book_names) {
+        const auto book = cache->GetBook(book_name);
+        ASSERT_EQUAL(book->GetContent(), lib.content.at(book_name)->GetContent());
+        ASSERT_EQUAL(book->GetContentView(), lib.content.at(book_name)->GetContent());
+      }
+    }
+
+    const auto stats = cache->GetStats();
+    const string hint(GetEvictionName(eviction));
+    // every evicted book is either still on its way down or on disk already
+    Assert(unpacker->GetUnpackedBooksCount() == static_cast<int>(lib.book_names.size()), hint);
+    Assert(stats.current_bytes <= settings.max_memory, hint);
+    // a book taken back before its disk copy was written keeps that copy
+    Assert(stats.spill_entry_count <= lib.book_names.size(), hint);
+  }
+}
+
+
+void TestSpillRestart(const Library& lib) {
+  TempDirectory directory;
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes / 4;
+  settings.spill_directory = directory.GetPath();
+  settings.spill_disk_budget = 1 << 20;
+  settings.spill_segment_size = 300;
+
+  size_t kept_in_memory = 0;
+  {
+    auto cache = MakeCache(make_shared<BooksUnpacker>(), settings);
+    for (const auto& book_name : lib.book_names) {
+      cache->GetBook(book_name);
+    }
+    kept_in_memory = cache->GetStats().entry_count;
+  }
+  ASSERT(directory.GetFiles().size() > 1);
+
+  // the books the first cache evicted come back from its files, only the ones it still held are unpacked
+  auto unpacker = make_shared<BooksUnpacker>();
+  auto cache = MakeCache(unpacker, settings);
+  ASSERT_EQUAL(cache->GetStats().spill_entry_count, lib.book_names.size() - kept_in_memory);
+  for (const auto& book_name : lib.book_names) {
+    ASSERT_EQUAL(cache->GetBook(book_name)->GetContent(), lib.content.at(book_name)->GetContent());
+  }
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), static_cast<int>(kept_in_memory));
+  ASSERT_EQUAL(cache->GetStats().spill_hits, lib.book_names.size() - kept_in_memory);
+}
+
+
+void TestSpillTornRecord(const Library&) {
+  TempDirectory directory;
+  const SpillTier::Settings settings{directory.GetPath(), 1 << 20, 1 << 10};
+  const string content(100, 'x');
+  {
+    SpillTier spill(settings);
+    for (const string book_name : {"a", "b", "c"}) {
+      spill.Add(book_name, book_name + content);
+    }
+  }
+  auto files = directory.GetFiles();
+  ASSERT_EQUAL(files.size(), 1u);
+  // a crash in the middle of writing "c"
+  filesystem::resize_file(files[0], filesystem::file_size(files[0]) - 10);
+
+  {
+    SpillTier spill(settings);
+    ASSERT_EQUAL(spill.GetEntryCount(), 2u);
+    ASSERT(spill.Take("c") == nullptr);
+    const auto book = spill.Take("b");
+    ASSERT(book != nullptr);
+    ASSERT_EQUAL(book->GetName(), "b");
+    ASSERT_EQUAL(book->GetContentView(), "b" + content);
+    ASSERT_EQUAL(spill.GetEntryCount(), 1u);
+    spill.Add("d", "d" + content);
+  }
+
+  // flip a byte of "a", the records after it in its segment go too, "d" lives in a segment of its own
+  files = directory.GetFiles();
+  ASSERT_EQUAL(files.size(), 2u);
+  {
+    fstream file(files[0], ios::in | ios::out | ios::binary);
+    file.seekp(30);
+    file.put('y');
+  }
+  SpillTier spill(settings);
+  ASSERT_EQUAL(spill.GetEntryCount(), 1u);
+  ASSERT(spill.Take("a") == nullptr);
+  ASSERT(spill.Take("b") == nullptr);
+  ASSERT_EQUAL(spill.Take("d")->GetContent(), "d" + content);
+}
+
+
+void TestSpillBudget(const Library&) {
+  TempDirectory directory;
+  // about 30 records of 100 bytes in segments of 4
+  const SpillTier::Settings settings{directory.GetPath(), 3000, 400};
+  SpillTier spill(settings);
+  const auto names = MakeBookNames(200);
+  const auto get_content = [](const string& book_name) {
+    return book_name + string(100 - book_name.size() - 24, '.');
+  };
+
+  vector<ICache::BookPtr> taken;
+  for (size_t i = 0; i < names.size(); ++i) {
+    spill.Add(names[i], get_content(names[i]));
+    ASSERT(spill.GetDiskUsage() <= settings.disk_budget);
+    // every other book comes back from disk soon, leaving its segment half dead
+    if (i % 2 == 1) {
+      taken.push_back(spill.Take(names[i - 1]));
+      ASSERT(taken.back() != nullptr);
+    }
+  }
+  ASSERT(spill.GetCompactionCount() > 0);
+  ASSERT(spill.GetEntryCount() > 10);
+
+  // taken books stay readable after their segments are compacted and deleted
+  for (size_t i = 0; i < taken.size(); ++i) {
+    ASSERT_EQUAL(taken[i]->GetContentView(), get_content(names[2 * i]));
+  }
+  size_t found = 0;
+  for (const auto& book_name : names) {
+    if (const auto book = spill.Take(book_name)) {
+      ASSERT_EQUAL(book->GetContent(), get_content(book_name));
+      ++found;
+    }
+  }
+  ASSERT(found > 10);
+  ASSERT_EQUAL(spill.GetEntryCount(), 0u);
+}
+
+
+void PrintReplayResults(const string& title, const vector<string>& trace, size_t max_memory) {
+  cout << title << ", " << trace.size() << " requests, max_memory " << max_memory << '\n';
+  for (const auto eviction : ALL_EVICTIONS) {
+    ICache::Settings settings;
+    settings.max_memory = max_memory;
+    settings.eviction = eviction;
+    const auto result = ReplayTrace(trace, settings);
+    cout << "  " << GetEvictionName(eviction) << ": hit ratio " << result.hit_ratio
+         << ", " << static_cast<size_t>(result.ops_per_second) << " ops/sec\n    ";
+    PrintStatsJson(cout, result.stats);
+    cout << '\n';
+  }
+}
+
+void BenchmarkEvictionPolicies(const Library&) {
+  const auto names = MakeBookNames(2000);
+  vector<string> zipf_trace;
+  for (const size_t book_idx : MakeZipfTrace(names.size(), 1000000, 42)) {
+    zipf_trace.push_back(names[book_idx]);
+  }
+  PrintReplayResults("Zipf", zipf_trace, 10000);
+  PrintReplayResults("Zipf with scans", MakeScanTrace(2000, 1000000, 1000, 400, 42), 10000);
+}
+
+// A handler that knows its next books: reading them one by one against prefetching the whole list first
+void BenchmarkPrefetch(const Library&) {
+  const auto names = MakeBookNames(64);
+  for (const bool prefetch : {false, true}) {
+    ICache::Settings settings;
+    settings.max_memory = 1 << 20;
+    settings.background_thread_count = 8;
+    auto cache = MakeCache(make_shared<SlowBooksUnpacker>(1ms), settings);
+    LOG_DURATION(string(prefetch ? "Prefetch, then" : "Only") + " GetBook of 64 books unpacked in 1ms");
+    if (prefetch) {
+      cache->Prefetch(names);
+    }
+    for (const auto& book_name : names) {
+      cache->GetBook(book_name);
+    }
+  }
+
+  static const int batch_count = 20000;
+  ICache::Settings settings;
+  settings.max_memory = 1 << 20;
+  settings.shard_count = 4;
+  auto cache = MakeCache(make_shared<BooksUnpacker>(), settings);
+  for (const auto& book_name : names) {
+    cache->GetBook(book_name);
+  }
+  {
+    LOG_DURATION("GetBook x64, " + to_string(batch_count) + " batches, all cached");
+    for (int i = 0; i < batch_count; ++i) {
+      for (const auto& book_name : names) {
+        cache->GetBook(book_name);
+      }
+    }
+  }
+  {
+    LOG_DURATION("GetBooks of 64, " + to_string(batch_count) + " batches, all cached");
+    for (int i = 0; i < batch_count; ++i) {
+      for (const auto& book : cache->GetBooks(names)) {
+        book.Get();
+      }
+    }
+  }
+}
+
+// Same total memory either all for unpacked books or split evenly with the compressed tier
+void BenchmarkCompressedTier(const Library&) {
+  static const size_t book_size = 32 * 1024;
+  static const size_t total_memory = 40 * book_size;
+  const auto names = MakeBookNames(400);
+  const auto trace = MakeZipfTrace(names.size(), 5000, 42);
+
+  for (const auto unpack_latency : {200us, 2000us}) {
+    for (const bool two_tiers : {false, true}) {
+      auto unpacker = make_shared<TextBooksUnpacker>(book_size, unpack_latency);
+      ICache::Settings settings;
+      settings.max_memory = two_tiers ? total_memory / 2 : total_memory;
+      settings.compressed_memory = two_tiers ? total_memory / 2 : 0;
+      auto cache = MakeCache(unpacker, settings);
+
+      const auto start = chrono::steady_clock::now();
+      for (const size_t book_idx : trace) {
+        cache->GetBook(names[book_idx]);
+      }
+      const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+      const auto stats = cache->GetStats();
+      cout << (two_tiers ? "Two tiers" : "One tier") << ", unpack " << unpack_latency.count() << " us, "
+           << total_memory / 1024 << " KiB of " << book_size / 1024 << " KiB books: "
+           << stats.entry_count + stats.compressed_entry_count << " books kept, "
+           << stats.hits << " hits, " << stats.compressed_hits << " compressed hits, "
+           << unpacker->GetUnpackedBooksCount() << " unpacks, "
+           << elapsed.count() << " ms, " << elapsed.count() * 1000 / stats.misses << " us per miss\n";
+    }
+  }
+
+  TextBooksUnpacker unpacker(book_size, 0us);
+  const string content = unpacker.UnpackBook("Miss cost")->GetContent();
+  static const int repeat_count = 200;
+  string compressed;
+  const auto compress_start = chrono::steady_clock::now();
+  for (int i = 0; i < repeat_count; ++i) {
+    compressed = Lz::Compress(content);
+  }
+  const auto decompress_start = chrono::steady_clock::now();
+  for (int i = 0; i < repeat_count; ++i) {
+    Lz::Decompress(compressed);
+  }
+  const auto finish = chrono::steady_clock::now();
+  cout << "Book of " << content.size() << " bytes compresses to " << compressed.size()
+       << ", compress " << chrono::duration_cast<chrono::microseconds>(decompress_start - compress_start).count() / repeat_count
+       << " us, decompress " << chrono::duration_cast<chrono::microseconds>(finish - decompress_start).count() / repeat_count
+       << " us, unpack 200 us plus generation\n";
+}
+
+// The same memory budget with and without the disk tier behind it, on a trace whose working set
+// is ten times the memory
+void BenchmarkSpillTier(const Library&) {
+  static const size_t book_size = 32 * 1024;
+  static const size_t total_memory = 40 * book_size;
+  const auto names = MakeBookNames(400);
+  const auto trace = MakeZipfTrace(names.size(), 5000, 42);
+
+  for (const auto unpack_latency : {200us, 2000us}) {
+    for (const bool spill : {false, true}) {
+      TempDirectory directory;
+      auto unpacker = make_shared<TextBooksUnpacker>(book_size, unpack_latency);
+      ICache::Settings settings;
+      settings.max_memory = total_memory;
+      settings.spill_directory = directory.GetPath();
+      settings.spill_disk_budget = spill ? 2 * names.size() * book_size : 0;
+      auto cache = MakeCache(unpacker, settings);
+
+      const auto start = chrono::steady_clock::now();
+      for (const size_t book_idx : trace) {
+        // reading every byte makes the mapped books page in
+        const auto content = cache->GetBook(names[book_idx])->GetContentView();
+        ASSERT(content.size() >= book_size && count(content.begin(), content.end(), '\0') == 0);
+      }
+      const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+      const auto stats = cache->GetStats();
+      cout << (spill ? "Memory and disk" : "Memory only") << ", unpack " << unpack_latency.count() << " us: "
+           << stats.hits << " hits, " << stats.spill_hits << " disk hits, "
+           << unpacker->GetUnpackedBooksCount() << " unpacks, " << stats.spill_bytes / 1024 << " KiB on disk, "
+           << elapsed.count() << " ms, " << elapsed.count() * 1000 / stats.misses << " us per miss\n";
+    }
+  }
+}
+
+// Books differ in size and unpack time independently, as when some of them sit on a slow remote store.
+// Reports the total unpack time each policy leaves to pay for the same budget.
+void BenchmarkUnpackCost(const Library&) {
+  const auto names = MakeBookNames(300);
+  const auto trace = MakeZipfTrace(names.size(), 4000, 42);
+  const auto get_cost = [](const string& book_name) {
+    const size_t book_hash = hash<string>()(book_name);
+    const size_t size = 1024 + book_hash % (63 * 1024);
+    // one book in five is twenty times as expensive
+    const auto latency = (book_hash >> 20) % 5 == 0 ? 2000us : 100us;
+    return CostlyBooksUnpacker::BookCost{size, latency};
+  };
+
+  size_t total_size = 0;
+  for (const auto& book_name : names) {
+    total_size += get_cost(book_name).first;
+  }
+  cout << "Unpack cost, " << trace.size() << " Zipf requests over " << names.size()
+       << " books, a tenth of their bytes fit\n";
+  for (const auto eviction : ALL_EVICTIONS) {
+    auto unpacker = make_shared<CostlyBooksUnpacker>(get_cost);
+    ICache::Settings settings;
+    settings.max_memory = total_size / 10;
+    settings.eviction = eviction;
+    settings.accounting = ICache::Settings::Accounting::EXACT;
+    auto cache = MakeCache(unpacker, settings);
+    for (const size_t book_idx : trace) {
+      cache->GetBook(names[book_idx]);
+    }
+    const auto stats = cache->GetStats();
+    cout << "  " << GetEvictionName(eviction) << ": hit ratio " << static_cast<double>(stats.hits) / trace.size()
+         << ", " << unpacker->GetUnpackedBooksCount() << " unpacks, "
+         << chrono::duration_cast<chrono::milliseconds>(unpacker->GetTotalLatency()).count() << " ms of unpacking\n";
+  }
+}
+
+// One book name per line, for example an access log cut down to the requested names
+void ReplayTraceFile(const string& path) {
+  ifstream input(path);
+  vector<string> trace;
+  for (string book_name; getline(input, book_name);) {
+    trace.push_back(move(book_name));
+  }
+  // a tenth of the distinct books fit, as in the synthetic traces
+  const size_t distinct_count = unordered_set<string_view>(trace.begin(), trace.end()).size();
+  PrintReplayResults(path, trace, distinct_count * 40 / 10);
+}
+
+
+// One thread, every request a hit on names too long to be stored inline, looked up
+// by string_view as a caller parsing them out of a request would
+void BenchmarkHitPath(const Library&) {
+  static const int request_count = 2000000;
+  vector<string> names = MakeBookNames(1000);
+  for (auto& name : names) {
+    name = "The Collected Works, Volume " + name;
+  }
+  const vector<string_view> name_views(names.begin(), names.end());
+  const auto trace = MakeZipfTrace(names.size(), request_count, 42);
+
+  for (const auto eviction : ALL_EVICTIONS) {
+    ICache::Settings settings;
+    settings.max_memory = 1 << 20;
+    settings.eviction = eviction;
+    auto cache = MakeCache(make_shared<BooksUnpacker>(), settings);
+    for (const auto& name : names) {
+      cache->GetBook(name);
+    }
+
+    const size_t allocations_before = allocation_count.load(memory_order_relaxed);
+    const auto start = chrono::steady_clock::now();
+    for (const size_t book_idx : trace) {
+      cache->GetBook(name_views[book_idx]);
+    }
+    const chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    cout << GetEvictionName(eviction) << ": " << elapsed.count() / request_count << " ns per hit, "
+         << allocation_count.load(memory_order_relaxed) - allocations_before << " allocations\n";
+  }
+}
+
+
+void BenchmarkThreadScaling(const Library&) {
+  static const int requests_per_thread = 200000;
+  const auto names = MakeBookNames(1000);
+
+  for (const size_t shard_count : {1, 16}) {
+    for (const int thread_count : {1, 2, 4, 8}) {
+      ICache::Settings settings;
+      // everything fits, so the benchmark measures the hit path only
+      settings.max_memory = 1 << 20;
+      settings.shard_count = shard_count;
+      auto cache = MakeCache(make_shared<BooksUnpacker>(), settings);
+
+      ostringstream title;
+      title << "shards " << shard_count << ", threads " << thread_count << ", "
+            << requests_per_thread << " hits each";
+      LOG_DURATION(title.str());
+      vector<future<void>> tasks;
+      for (int task_num = 0; task_num < thread_count; ++task_num) {
+        tasks.push_back(async(launch::async, [&cache, &names, task_num] {
+          default_random_engine gen(task_num);
+          uniform_int_distribution<size_t> dis(0, names.size() - 1);
+          for (int i = 0; i < requests_per_thread; ++i) {
+            cache->GetBook(names[dis(gen)]);
+          }
+        }));
+      }
+      for (auto& task : tasks) {
+        task.get();
+      }
+    }
+  }
+}
+
+
+int main(int argc, char* argv[]) {
   BooksUnpacker unpacker;
   const Library lib(
     {
@@ -181,6 +1533,21 @@ int main() {
     unpacker
   );
 
+  if (argc > 1 && argv[1] == "--bench"sv) {
+    BenchmarkThreadScaling(lib);
+    BenchmarkHitPath(lib);
+    BenchmarkEvictionPolicies(lib);
+    BenchmarkPrefetch(lib);
+    BenchmarkCompressedTier(lib);
+    BenchmarkSpillTier(lib);
+    BenchmarkUnpackCost(lib);
+    return 0;
+  }
+  if (argc > 2 && argv[1] == "--replay"sv) {
+    ReplayTraceFile(argv[2]);
+    return 0;
+  }
+
 #define RUN_CACHE_TEST(tr, f) tr.RunTest([&lib] { f(lib); }, #f)
 
   TestRunner tr;
@@ -189,6 +1556,35 @@ int main() {
   RUN_CACHE_TEST(tr, TestCaching);
   RUN_CACHE_TEST(tr, TestSmallCache);
   RUN_CACHE_TEST(tr, TestAsync);
+  RUN_CACHE_TEST(tr, TestShardedAsync);
+  RUN_CACHE_TEST(tr, TestShardedMaxMemory);
+  RUN_CACHE_TEST(tr, TestShardedHitRatio);
+  RUN_CACHE_TEST(tr, TestSingleFlight);
+  RUN_CACHE_TEST(tr, TestParallelMisses);
+  RUN_CACHE_TEST(tr, TestHitDuringMiss);
+  RUN_CACHE_TEST(tr, TestFailedUnpack);
+  RUN_CACHE_TEST(tr, TestEvictionMaxMemory);
+  RUN_CACHE_TEST(tr, TestEvictionCaching);
+  RUN_CACHE_TEST(tr, TestEvictionSmallCache);
+  RUN_CACHE_TEST(tr, TestEvictionAsync);
+  RUN_CACHE_TEST(tr, TestScanResistance);
+  RUN_CACHE_TEST(tr, TestStats);
+  RUN_CACHE_TEST(tr, TestStatsUnderLoad);
+  RUN_CACHE_TEST(tr, TestStatsJson);
+  RUN_CACHE_TEST(tr, TestPrefetch);
+  RUN_CACHE_TEST(tr, TestGetBooks);
+  RUN_CACHE_TEST(tr, TestGetBooksFailure);
+  RUN_CACHE_TEST(tr, TestDestroyWhilePrefetching);
+  RUN_CACHE_TEST(tr, TestCompression);
+  RUN_CACHE_TEST(tr, TestCompressedTier);
+  RUN_CACHE_TEST(tr, TestCompressedTierBudget);
+  RUN_CACHE_TEST(tr, TestExactAccounting);
+  RUN_CACHE_TEST(tr, TestGreedyDualSizeKeepsExpensive);
+  RUN_CACHE_TEST(tr, TestHitAllocatesNothing);
+  RUN_CACHE_TEST(tr, TestSpillTier);
+  RUN_CACHE_TEST(tr, TestSpillRestart);
+  RUN_CACHE_TEST(tr, TestSpillTornRecord);
+  RUN_CACHE_TEST(tr, TestSpillBudget);
 
 #undef RUN_CACHE_TEST
   return 0;
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Hash map from book names to Value, looked up by string_view, so finding a book never builds a string.
+// Open addressing with linear probing in one slot array: a lookup touches one or two cache lines and
+// allocates nothing. Erase shifts the following entries back instead of leaving tombstones.
+// Pointers to values stay valid until the next Insert or Erase.
+template <typename Value>
+class NameIndex {
+    struct Slot {
+        bool used = false;
+        size_t hash = 0;
+        std::string name;
+        Value value{};
+    };
+
+public:
+    // The slot array doubles when it gets 3/4 full and never shrinks, a policy keeps about
+    // as many books as its budget allows, so an entry takes about two slots
+    static constexpr size_t AVERAGE_ENTRY_SIZE = 2 * sizeof(Slot);
+
+    Value* Find(std::string_view name) {
+        return const_cast<Value*>(std::as_const(*this).Find(name));
+    }
+
+    const Value* Find(std::string_view name) const {
+        if (size_ == 0) {
+            return nullptr;
+        }
+        const size_t hash = hasher_(name);
+        for (size_t i = GetHome(hash); slots_[i].used; i = (i + 1) & mask_) {
+            if (slots_[i].hash == hash && slots_[i].name == name) {
+                return &slots_[i].value;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Contains(std::string_view name) const {
+        return Find(name) != nullptr;
+    }
+
+    // The value of a name known to be there
+    Value& At(std::string_view name) {
+        return *Find(name);
+    }
+
+    // Replaces the value if the name is there already
+    Value& Insert(std::string_view name, Value value) {
+        if (Value* existing = Find(name)) {
+            *existing = std::move(value);
+            return *existing;
+        }
+        if (4 * (size_ + 1) > 3 * slots_.size()) {
+            Rehash(std::max<size_t>(MIN_CAPACITY, 2 * slots_.size()));
+        }
+        const size_t hash = hasher_(name);
+        size_t i = GetHome(hash);
+        while (slots_[i].used) {
+            i = (i + 1) & mask_;
+        }
+        Slot& slot = slots_[i];
+        slot.used = true;
+        slot.hash = hash;
+        slot.name.assign(name);
+        slot.value = std::move(value);
+        ++size_;
+        return slot.value;
+    }
+
+    bool Erase(std::string_view name) {
+        if (size_ == 0) {
+            return false;
+        }
+        const size_t hash = hasher_(name);
+        size_t i = GetHome(hash);
+        while (slots_[i].used && !(slots_[i].hash == hash && slots_[i].name == name)) {
+            i = (i + 1) & mask_;
+        }
+        if (!slots_[i].used) {
+            return false;
+        }
+        // an entry further on moves into the hole if the hole lies between its home and its slot
+        for (size_t j = (i + 1) & mask_; slots_[j].used; j = (j + 1) & mask_) {
+            if (((j - GetHome(slots_[j].hash)) & mask_) >= ((j - i) & mask_)) {
+                std::swap(slots_[i], slots_[j]);
+                i = j;
+            }
+        }
+        Release(slots_[i]);
+        --size_;
+        return true;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    std::hash<std::string_view> hasher_;
+    std::vector<Slot> slots_;  // the size is a power of two
+    size_t mask_ = 0;
+    size_t shift_ = 64;
+    size_t size_ = 0;
+
+    // Fibonacci hashing: the high bits of the product depend on every bit of the hash,
+    // so the names of one cache shard, which share hash % shard_count, still spread out
+    size_t GetHome(size_t hash) const {
+        return static_cast<size_t>((static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ull) >> shift_) & mask_;
+    }
+
+    static void Release(Slot& slot) {
+        slot.used = false;
+        std::string().swap(slot.name);
+        slot.value = Value{};
+    }
+
+    void Rehash(size_t capacity) {
+        std::vector<Slot> old_slots(capacity);
+        old_slots.swap(slots_);
+        mask_ = capacity - 1;
+        shift_ = 64;
+        for (size_t c = capacity; c > 1; c /= 2) {
+            --shift_;
+        }
+        for (Slot& slot : old_slots) {
+            if (!slot.used) {
+                continue;
+            }
+            size_t i = GetHome(slot.hash);
+            while (slots_[i].used) {
+                i = (i + 1) & mask_;
+            }
+            slots_[i] = std::move(slot);
+        }
+    }
+};
@@ -0,0 +1,392 @@
+#include "spill.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+    const uint32_t RECORD_MAGIC = 0x42534b31;  // "1KSB"
+    const char SEGMENT_PREFIX[] = "segment-";
+    const char SEGMENT_SUFFIX[] = ".spill";
+
+    // Precedes the name and the content of every book in a segment
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t name_size;
+        uint64_t content_size;
+        uint64_t checksum;  // of the name and the content, catches a record torn by a crash
+    };
+
+    size_t GetRecordSize(size_t name_size, size_t content_size) {
+        return sizeof(RecordHeader) + name_size + content_size;
+    }
+
+    uint64_t GetChecksum(string_view name, string_view content) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (string_view part : {name, content}) {
+            for (unsigned char c : part) {
+                hash = (hash ^ c) * 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+    runtime_error MakeError(const string& action, const string& path) {
+        return runtime_error(action + " " + path + ": " + strerror(errno));
+    }
+
+    void WriteAll(int fd, const string& path, size_t offset, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            const ssize_t written = pwrite(fd, bytes, size, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw MakeError("cannot write", path);
+            }
+            bytes += written;
+            offset += written;
+            size -= written;
+        }
+    }
+
+    // A book read straight from a segment mapping, the segment stays mapped while the book is alive.
+    // GetContent copies the content on first call, GetContentView never does.
+    class MappedBook : public IBook {
+    public:
+        MappedBook(string name, shared_ptr<const void> mapping, string_view content)
+            : name_(move(name))
+            , mapping_(move(mapping))
+            , content_view_(content)
+        {
+        }
+
+        const string& GetName() const override {
+            return name_;
+        }
+
+        const string& GetContent() const override {
+            call_once(content_copied_, [this] {
+                content_.assign(content_view_);
+            });
+            return content_;
+        }
+
+        string_view GetContentView() const override {
+            return content_view_;
+        }
+
+    private:
+        string name_;
+        shared_ptr<const void> mapping_;
+        string_view content_view_;
+        mutable once_flag content_copied_;
+        mutable string content_;
+    };
+}
+
+// One file of records. The file is never written through the mapping, appends go through pwrite
+// and show up in the MAP_SHARED mapping by themselves.
+struct SpillTier::Segment {
+    string path;
+    int fd = -1;
+    const char* data = nullptr;
+    size_t mapped_size = 0;
+    size_t written = 0;
+    size_t live_bytes = 0;  // records the index still points to
+
+    Segment(string path, int fd, size_t size) : path(move(path)), fd(fd) {
+        if (size == 0) {
+            return;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            const auto error = MakeError("cannot map", this->path);
+            close(fd);
+            throw error;
+        }
+        data = static_cast<const char*>(mapping);
+        mapped_size = size;
+    }
+
+    ~Segment() {
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), mapped_size);
+        }
+        close(fd);
+    }
+
+    // The free tail of the file goes away, the mapping keeps its length but nothing reads past written
+    void Seal() {
+        if (ftruncate(fd, static_cast<off_t>(written)) != 0) {
+            throw MakeError("cannot resize", path);
+        }
+    }
+};
+
+SpillTier::SpillTier(Settings settings) : settings_(move(settings)) {
+    error_code error;
+    filesystem::create_directories(settings_.directory, error);
+    if (error) {
+        throw runtime_error("cannot create " + settings_.directory + ": " + error.message());
+    }
+    Load();
+    MakeRoom(0);
+}
+
+SpillTier::~SpillTier() {
+    if (active_) {
+        try {
+            active_->Seal();
+        }
+        catch (const exception&) {
+            // the next Load cuts the unwritten tail off anyway
+        }
+    }
+}
+
+ICache::BookPtr SpillTier::Take(const string& book_name) {
+    lock_guard lock(m_);
+    auto it = index_.find(book_name);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    const Location location = it->second;
+    Forget(it);
+    const char* content = location.segment->data + location.offset + sizeof(RecordHeader) + book_name.size();
+    return make_shared<MappedBook>(book_name, location.segment, string_view(content, location.content_size));
+}
+
+void SpillTier::Add(const string& book_name, string_view content) {
+    lock_guard lock(m_);
+    if (auto it = index_.find(book_name); it != index_.end()) {
+        Forget(it);
+    }
+    const size_t record_size = GetRecordSize(book_name.size(), content.size());
+    if (record_size > settings_.disk_budget) {
+        return;
+    }
+    MakeRoom(record_size);
+    Append(book_name, content);
+}
+
+void SpillTier::Remove(const string& book_name) {
+    lock_guard lock(m_);
+    if (auto it = index_.find(book_name); it != index_.end()) {
+        Forget(it);
+    }
+}
+
+size_t SpillTier::GetDiskUsage() const {
+    lock_guard lock(m_);
+    return disk_usage_;
+}
+
+size_t SpillTier::GetEntryCount() const {
+    lock_guard lock(m_);
+    return index_.size();
+}
+
+size_t SpillTier::GetCompactionCount() const {
+    lock_guard lock(m_);
+    return compaction_count_;
+}
+
+// Segments are read in the order they were written, so a later record of a book replaces an earlier one
+void SpillTier::Load() {
+    vector<pair<size_t, string>> files;
+    for (const auto& entry : filesystem::directory_iterator(settings_.directory)) {
+        const string file_name = entry.path().filename().string();
+        const size_t prefix_size = sizeof(SEGMENT_PREFIX) - 1;
+        const size_t suffix_size = sizeof(SEGMENT_SUFFIX) - 1;
+        if (file_name.size() <= prefix_size + suffix_size
+            || file_name.compare(0, prefix_size, SEGMENT_PREFIX) != 0
+            || file_name.compare(file_name.size() - suffix_size, suffix_size, SEGMENT_SUFFIX) != 0) {
+            continue;
+        }
+        const string id = file_name.substr(prefix_size, file_name.size() - prefix_size - suffix_size);
+        if (!all_of(id.begin(), id.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); })) {
+            continue;
+        }
+        files.emplace_back(stoull(id), entry.path().string());
+    }
+    sort(files.begin(), files.end());
+
+    for (const auto& [id, path] : files) {
+        next_segment_id_ = max(next_segment_id_, id + 1);
+        const int fd = open(path.c_str(), O_RDWR);
+        if (fd < 0) {
+            throw MakeError("cannot open", path);
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            const auto error = MakeError("cannot stat", path);
+            close(fd);
+            throw error;
+        }
+        auto segment = make_shared<Segment>(path, fd, static_cast<size_t>(file_stat.st_size));
+
+        vector<pair<string, Location>> records;
+        size_t offset = 0;
+        while (offset + sizeof(RecordHeader) <= segment->mapped_size) {
+            RecordHeader header;
+            memcpy(&header, segment->data + offset, sizeof(header));
+            const size_t body_size = segment->mapped_size - offset - sizeof(header);
+            if (header.magic != RECORD_MAGIC || header.name_size > body_size
+                || header.content_size > body_size - header.name_size) {
+                break;
+            }
+            const string_view name(segment->data + offset + sizeof(header), header.name_size);
+            const string_view content(name.data() + name.size(), header.content_size);
+            if (GetChecksum(name, content) != header.checksum) {
+                break;
+            }
+            records.push_back({string(name), {segment, offset, content.size()}});
+            offset += GetRecordSize(name.size(), content.size());
+        }
+        segment->written = offset;
+        if (segment->written == 0) {
+            unlink(path.c_str());
+            continue;
+        }
+        if (segment->written < segment->mapped_size) {
+            segment->Seal();
+        }
+
+        for (auto& [book_name, location] : records) {
+            if (auto it = index_.find(book_name); it != index_.end()) {
+                Forget(it);
+            }
+            segment->live_bytes += GetRecordSize(book_name.size(), location.content_size);
+            index_.emplace(move(book_name), move(location));
+        }
+        disk_usage_ += segment->written;
+        segments_.push_back(move(segment));
+    }
+}
+
+void SpillTier::Append(const string& book_name, string_view content) {
+    const size_t record_size = GetRecordSize(book_name.size(), content.size());
+    if (!active_ || active_->written + record_size > active_->mapped_size) {
+        StartSegment(record_size);
+    }
+    RecordHeader header{RECORD_MAGIC, static_cast<uint32_t>(book_name.size()), content.size(),
+                        GetChecksum(book_name, content)};
+    const size_t offset = active_->written;
+    WriteAll(active_->fd, active_->path, offset, &header, sizeof(header));
+    WriteAll(active_->fd, active_->path, offset + sizeof(header), book_name.data(), book_name.size());
+    WriteAll(active_->fd, active_->path, offset + sizeof(header) + book_name.size(), content.data(), content.size());
+
+    active_->written += record_size;
+    active_->live_bytes += record_size;
+    disk_usage_ += record_size;
+    index_[book_name] = {active_, offset, content.size()};
+}
+
+// Frees the cheapest bytes first: segments nobody reads, then segments worth compacting,
+// then the oldest books
+void SpillTier::MakeRoom(size_t record_size) {
+    while (disk_usage_ + record_size > settings_.disk_budget) {
+        auto dead = find_if(segments_.begin(), segments_.end(), [](const auto& segment) {
+            return segment->live_bytes == 0;
+        });
+        if (dead != segments_.end()) {
+            Drop(*dead);
+            continue;
+        }
+        auto sparsest = min_element(segments_.begin(), segments_.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs->live_bytes * rhs->written < rhs->live_bytes * lhs->written;
+        });
+        // copying out less than half of a segment frees more than it writes
+        if (sparsest != segments_.end() && 2 * (*sparsest)->live_bytes < (*sparsest)->written) {
+            Compact(*sparsest);
+            continue;
+        }
+        if (!segments_.empty()) {
+            Drop(segments_.front());
+            continue;
+        }
+        if (active_ && active_->written > 0) {
+            active_->Seal();
+            segments_.push_back(move(active_));
+            continue;
+        }
+        break;
+    }
+}
+
+void SpillTier::Drop(shared_ptr<Segment> segment) {
+    if (segment->live_bytes > 0) {
+        for (auto it = index_.begin(); it != index_.end();) {
+            if (it->second.segment == segment) {
+                it = index_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+    segments_.erase(find(segments_.begin(), segments_.end(), segment));
+    disk_usage_ -= segment->written;
+    // books taken from the segment keep reading the unlinked file through their mappings
+    unlink(segment->path.c_str());
+}
+
+void SpillTier::Compact(shared_ptr<Segment> segment) {
+    vector<pair<size_t, string>> live;  // offsets and names, copied in the order they were written
+    for (const auto& [book_name, location] : index_) {
+        if (location.segment == segment) {
+            live.emplace_back(location.offset, book_name);
+        }
+    }
+    sort(live.begin(), live.end());
+    for (const auto& [offset, book_name] : live) {
+        const char* content = segment->data + offset + sizeof(RecordHeader) + book_name.size();
+        const size_t content_size = index_[book_name].content_size;
+        Forget(index_.find(book_name));
+        Append(book_name, string_view(content, content_size));
+    }
+    Drop(move(segment));
+    ++compaction_count_;
+}
+
+void SpillTier::StartSegment(size_t min_size) {
+    if (active_) {
+        active_->Seal();
+        segments_.push_back(move(active_));
+    }
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "%s%06zu%s", SEGMENT_PREFIX, next_segment_id_++, SEGMENT_SUFFIX);
+    const string path = settings_.directory + "/" + file_name;
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw MakeError("cannot open", path);
+    }
+    // dropping the oldest segment should not throw away most of the tier
+    const size_t size = max(min(settings_.segment_size, settings_.disk_budget / 4), min_size);
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        const auto error = MakeError("cannot resize", path);
+        close(fd);
+        throw error;
+    }
+    active_ = make_shared<Segment>(path, fd, size);
+}
+
+void SpillTier::Forget(unordered_map<string, Location>::iterator it) {
+    it->second.segment->live_bytes -= GetRecordSize(it->first.size(), it->second.content_size);
+    index_.erase(it);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Evicted books on local disk. Records are appended to segment files in one directory and read back
+// through read-only mappings, so a book served from here is not copied into memory until somebody
+// asks for GetContent. Books never change, so a record left behind by a crash or a lost index entry
+// is at worst redundant, never wrong. Thread-safe.
+class SpillTier {
+public:
+    struct Settings {
+        std::string directory;  // one SpillTier at a time, created if missing
+        size_t disk_budget = 0;
+        size_t segment_size = 0;  // a quarter of disk_budget at most
+    };
+
+    // Indexes every intact record of the segments already in the directory. A torn record and
+    // whatever follows it in its segment is cut off. Throws runtime_error if the directory is unusable.
+    explicit SpillTier(Settings settings);
+    ~SpillTier();
+
+    SpillTier(const SpillTier&) = delete;
+    SpillTier& operator=(const SpillTier&) = delete;
+
+    // The book backed by its mapping, or nullptr. It leaves the index, its record turns dead.
+    ICache::BookPtr Take(const std::string& book_name);
+
+    // Appends a record. Room is made by deleting dead segments, compacting mostly dead ones
+    // and dropping the oldest. A book larger than the whole budget is not written.
+    void Add(const std::string& book_name, std::string_view content);
+
+    void Remove(const std::string& book_name);
+
+    // Bytes of records in all segments, live or dead
+    size_t GetDiskUsage() const;
+    size_t GetEntryCount() const;
+    size_t GetCompactionCount() const;
+
+private:
+    struct Segment;
+
+    struct Location {
+        std::shared_ptr<Segment> segment;
+        size_t offset;  // of the record header
+        size_t content_size;
+    };
+
+    Settings settings_;
+    mutable std::mutex m_;
+    std::vector<std::shared_ptr<Segment>> segments_;  // sealed ones, oldest first
+    std::shared_ptr<Segment> active_;  // takes the appends
+    std::unordered_map<std::string, Location> index_;
+    size_t next_segment_id_ = 1;
+    size_t disk_usage_ = 0;
+    size_t compaction_count_ = 0;
+
+    void Load();
+    void Append(const std::string& book_name, std::string_view content);
+    void MakeRoom(size_t record_size);
+    void Drop(std::shared_ptr<Segment> segment);
+    void Compact(std::shared_ptr<Segment> segment);
+    void StartSegment(size_t min_size);
+    void Forget(std::unordered_map<std::string, Location>::iterator it);
+};
@@ -0,0 +1,44 @@
+#include "thread_pool.h"
+using namespace std;
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    workers_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back([this] { Work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(m_);
+        stopping_ = true;
+    }
+    task_added_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Add(function<void()> task) {
+    {
+        lock_guard lock(m_);
+        tasks_.push_back(move(task));
+    }
+    task_added_.notify_one();
+}
+
+void ThreadPool::Work() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock lock(m_);
+            task_added_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
@@ -1,10 +1,19 @@
 #include "TransportDb.h"
+#include "memory_usage.h"
+
+#include <charconv>
+#include <iterator>
+#include <type_traits>
 
 using namespace std;
 
 namespace TransportDataBase {
 
-    BusManager::BusManager(std::vector<Descriptions::InputQuery> queries, const Json::Dict& routing_settings_json) {
+    BusManager::BusManager(std::vector<Descriptions::InputQuery> queries,
+        const Json::Dict& routing_settings_json,
+        const Json::Dict& render_settings_json,
+        size_t thread_count,
+        BusStatsMode bus_stats_mode) {
         auto stops_end = partition(queries.begin(), queries.end(), [](const auto& item) {
             return holds_alternative<Descriptions::Stop>(item);
             });
@@ -13,54 +22,192 @@ namespace TransportDataBase {
         for (const auto& item : Range{ begin(queries), stops_end }) {
             const auto& stop = get<Descriptions::Stop>(item);
             stops_dict[stop.name] = &stop;
-            stops_.insert({ stop.name, {} });
+            if (stops_.count(stop.name) == 0) {
+                stops_.emplace(stop_names_.emplace_back(stop.name), Stop{});
+            }
         }
 
         Descriptions::BusesDict buses_dict;
         for (const auto& item : Range{ stops_end, end(queries) }) {
             const auto& bus = get<Descriptions::Bus>(item);
-
             buses_dict[bus.name] = &bus;
-            buses_[bus.name] = Bus{
-              bus.stops.size(),
-              ComputeUniqueItemsCount(AsRange(bus.stops)),
-              ComputeRoadRouteLength(bus.stops, stops_dict),
-              ComputeGeoRouteDistance(bus.stops, stops_dict)
-            };
-
-            for (const string& stop_name : bus.stops) {
-                stops_.at(stop_name).bus_names.insert(bus.name);
+        }
+
+        auto network = Descriptions::CompactNetwork::Build(stops_dict, buses_dict);
+        descriptions_bytes_ = Descriptions::EstimateHeapBytes(queries);
+        network_bytes_ = network.GetHeapBytes();
+        // road distances live in network.road_distances from now on
+        for (auto& item : Range{ begin(queries), stops_end }) {
+            get<Descriptions::Stop>(item).distances = {};
+        }
+        {
+            STATS_PHASE("bus_stats");
+            vector<Stop*> stops_responses;
+            stops_vectors_.reserve(network.stops.size());
+            stops_responses.reserve(network.stops.size());
+            for (const auto* stop : network.stops) {
+                stops_vectors_.push_back(Sphere::UnitVector::FromPoint(stop->position));
+                stops_responses.push_back(&stops_.find(stop->name)->second);
+            }
+
+            vector<BusEntry*> entries;
+            entries.reserve(network.buses.size());
+            for (const auto& bus : network.buses) {
+                BusEntry& entry = buses_[bus_names_.emplace_back(bus.bus->name)];
+                entry.stops = bus.stops;
+                entry.is_roundtrip = bus.bus->is_roundtrip;
+                entries.push_back(&entry);
+
+                for (const Descriptions::StopId stop_id : bus.stops) {
+                    stops_responses[stop_id]->bus_names.insert(bus.bus->name);
+                }
+            }
+
+            if (bus_stats_mode == BusStatsMode::EAGER) {
+                // Per-bus stats are independent, each thread fills its own entries
+                ForEachChunkParallel(entries.size(), thread_count, [&](size_t first, size_t last) {
+                    for (size_t bus_idx = first; bus_idx < last; ++bus_idx) {
+                        BusEntry& entry = *entries[bus_idx];
+                        call_once(entry.stats_once, [&] {
+                            entry.stats = ComputeBusStats(entry, network.road_distances, stops_vectors_);
+                        });
+                        entry.stops = {};
+                    }
+                });
+                stops_vectors_ = {};
+            }
+        }
+        {
+            STATS_PHASE("stops_index");
+            vector<pair<string_view, Sphere::Point>> stops_positions;
+            stops_positions.reserve(stops_.size());
+            for (const auto& [name, _] : stops_) {
+                stops_positions.emplace_back(name, stops_dict.at(string(name))->position);
             }
+            stops_index_ = StopsIndex(stops_positions);
+        }
+        map_renderer_ = make_unique<MapRenderer>(network, render_settings_json);
+        router_ = make_unique<TransportRouter>(network, routing_settings_json, thread_count);
+        if (bus_stats_mode == BusStatsMode::LAZY) {
+            road_distances_ = move(network.road_distances);
         }
-        router_ = make_unique<TransportRouter>(stops_dict, buses_dict, routing_settings_json);
     }
 
-   const BusManager::Stop* BusManager::GetStop(const string& name) const {
+   const BusManager::Stop* BusManager::GetStop(string_view name) const {
        return GetValuePointer(stops_, name);
    }
 
-   const BusManager::Bus* BusManager::GetBus(const string& name) const {
-       return GetValuePointer(buses_, name);
+   const BusManager::Bus* BusManager::GetBus(string_view name) const {
+       const BusEntry* entry = GetValuePointer(buses_, name);
+       if (!entry) {
+           return nullptr;
+       }
+       call_once(entry->stats_once, [&] {
+           entry->stats = ComputeBusStats(*entry, road_distances_, stops_vectors_);
+       });
+       return &entry->stats;
    }
 
    optional<TransportRouter::RouteInfo> BusManager::FindRoute(const string& stop_from, const string& stop_to) const {
        return router_->FindRoute(stop_from, stop_to);
    }
 
-   int BusManager::ComputeRoadRouteLength(const vector<string>& stops, const Descriptions::StopsDict& stops_dict) {
+   optional<vector<TransportRouter::ReachableStop>> BusManager::FindReachableStops(const string& stop_from, double max_time) const {
+       return router_->FindReachableStops(stop_from, max_time);
+   }
+
+   vector<TransportRouter::RouteInfo> BusManager::FindParetoRoutes(const string& stop_from, const string& stop_to, size_t max_boardings) const {
+       return router_->FindParetoRoutes(stop_from, stop_to, max_boardings);
+   }
+
+   Json::SharedString BusManager::RenderMap() const {
+       call_once(map_once_, [this] {
+           STATS_PHASE("render_map");
+           atomic_store(&map_, Json::SharedString(make_shared<const string>(map_renderer_->Render())));
+       });
+       return map_;
+   }
+
+   vector<StopsIndex::Item> BusManager::FindNearestStops(Sphere::Point position, size_t count) const {
+       return stops_index_.FindNearest(position, count);
+   }
+
+   vector<StopsIndex::Item> BusManager::FindStopsInRadius(Sphere::Point position, double radius) const {
+       return stops_index_.FindInRadius(position, radius);
+   }
+
+   Json::Dict BusManager::MemoryReport() const {
+       size_t buses_bytes = Memory::HashTableBytes(buses_)
+           + road_distances_.GetHeapBytes() + Memory::VectorBytes(stops_vectors_);
+       for (const auto& [_, entry] : buses_) {
+           buses_bytes += Memory::VectorBytes(entry.stops);
+       }
+       for (const auto& name : bus_names_) {
+           buses_bytes += sizeof(name) + Memory::HeapBytes(name);
+       }
+       size_t stops_bytes = Memory::HashTableBytes(stops_);
+       for (const auto& name : stop_names_) {
+           stops_bytes += sizeof(name) + Memory::HeapBytes(name);
+       }
+       for (const auto& [_, stop] : stops_) {
+           stops_bytes += Memory::TreeBytes(stop.bus_names);
+           for (const auto& bus_name : stop.bus_names) {
+               stops_bytes += Memory::HeapBytes(bus_name);
+           }
+       }
+
+       const auto map = atomic_load(&map_);
+       const size_t map_bytes = map ? sizeof(*map) + Memory::HeapBytes(*map) : 0;
+       const size_t total = buses_bytes + stops_bytes + stops_index_.GetHeapBytes()
+           + map_renderer_->GetHeapBytes() + map_bytes + router_->GetMemoryUsage().GetTotal();
+
+       Json::Dict report = {
+           {"buses", Memory::AsKibNode(buses_bytes)},
+           {"stops", Memory::AsKibNode(stops_bytes)},
+           {"stops_index", Memory::AsKibNode(stops_index_.GetHeapBytes())},
+           {"map_renderer", Memory::AsKibNode(map_renderer_->GetHeapBytes())},
+           {"map", Memory::AsKibNode(map_bytes)},
+           {"transport_router", Json::Node(router_->MemoryReport())},
+           {"estimated_total", Memory::AsKibNode(total)},
+           {"build_only", Json::Dict{
+               {"descriptions", Memory::AsKibNode(descriptions_bytes_)},
+               {"compact_network", Memory::AsKibNode(network_bytes_)},
+           }},
+       };
+       if (const size_t live_bytes = Stats::GetLiveBytes(); live_bytes > 0) {
+           report["tracked_live"] = Memory::AsKibNode(live_bytes);
+           report["tracked_peak"] = Memory::AsKibNode(Stats::GetPeakLiveBytes());
+       }
+       return report;
+   }
+
+   BusManager::Bus BusManager::ComputeBusStats(const BusEntry& entry, const Descriptions::RoadDistances& road_distances,
+       const vector<Sphere::UnitVector>& stops_vectors) const {
+       const RouteView route(entry.stops, entry.is_roundtrip);
+       return Bus{
+           route.size(),
+           ComputeUniqueItemsCount(AsRange(entry.stops)),
+           ComputeRoadRouteLength(route, road_distances),
+           ComputeGeoRouteDistance(route, stops_vectors)
+       };
+   }
+
+   int BusManager::ComputeRoadRouteLength(const RouteView<Descriptions::StopId>& route, const Descriptions::RoadDistances& road_distances) const {
        int result = 0;
-       for (size_t i = 1; i < stops.size(); ++i) {
-           result += Descriptions::ComputeStopsDistance(*stops_dict.at(stops[i - 1]), *stops_dict.at(stops[i]));
+       for (size_t i = 1; i < route.size(); ++i) {
+           result += road_distances.Get(route[i - 1], route[i]);
        }
        return result;
    }
 
-   double BusManager::ComputeGeoRouteDistance(const vector<string>& stops, const Descriptions::StopsDict& stops_dict) {
-       double result = 0;
+   double BusManager::ComputeGeoRouteDistance(const RouteView<Descriptions::StopId>& route, const vector<Sphere::UnitVector>& stops_vectors) const {
+       const auto& stops = route.GetItems();
+       double distance = 0;
        for (size_t i = 1; i < stops.size(); ++i) {
-           result += Sphere::Distance(stops_dict.at(stops[i - 1])->position, stops_dict.at(stops[i])->position);
+           distance += Sphere::Distance(stops_vectors[stops[i - 1]], stops_vectors[stops[i]]);
        }
-       return result;
+       // great-circle distance is symmetric, the way back of a linear route costs the same
+       return route.IsRoundtrip() ? distance : distance * 2;
    }
 
    std::ostream& PrintStop(std::ostream& stream, const Descriptions::Stop& stop) {
@@ -90,11 +237,114 @@ namespace TransportDataBase {
        }
    }
 
+   namespace {
+       // Collects text responses and hands them to the stream in chunks instead of flushing every line
+       class ChunkedWriter {
+       public:
+           static const size_t CHUNK_SIZE = 1 << 16;
+
+           explicit ChunkedWriter(ostream& output)
+               : output_(output)
+           {
+               buffer_.reserve(CHUNK_SIZE * 2);
+           }
+
+           ChunkedWriter& operator<<(string_view text) {
+               buffer_.append(text);
+               return *this;
+           }
+
+           ChunkedWriter& operator<<(char c) {
+               buffer_.push_back(c);
+               return *this;
+           }
+
+           template <typename Number, enable_if_t<is_arithmetic_v<Number>, int> = 0>
+           ChunkedWriter& operator<<(Number value) {
+               char chars[32];
+               to_chars_result result;
+               if constexpr (is_floating_point_v<Number>) {
+                   // same digits as an ostream with setprecision(6)
+                   result = to_chars(begin(chars), end(chars), value, chars_format::general, 6);
+               }
+               else {
+                   result = to_chars(begin(chars), end(chars), value);
+               }
+               buffer_.append(chars, result.ptr);
+               return *this;
+           }
+
+           void EndLine() {
+               buffer_.push_back('\n');
+               if (buffer_.size() >= CHUNK_SIZE) {
+                   Flush();
+               }
+           }
+
+           void Flush() {
+               output_.write(buffer_.data(), buffer_.size());
+               buffer_.clear();
+           }
+
+       private:
+           ostream& output_;
+           string buffer_;
+       };
+   }
+
+   void BusManager::ProcessQueriesBatched(istream& input, ostream& output) const {
+       const string data{ istreambuf_iterator<char>(input), istreambuf_iterator<char>() };
+       string_view rest(data);
+
+       string_view count_line = Descriptions::ReadToken(rest, "\n");
+       count_line.remove_prefix(min(count_line.find_first_not_of(" \t"), count_line.size()));
+       size_t request_count = 0;
+       from_chars(count_line.data(), count_line.data() + count_line.size(), request_count);
+
+       ChunkedWriter writer(output);
+       for (size_t i = 0; i < request_count && !rest.empty(); ++i) {
+           string_view query = Descriptions::ReadToken(rest, "\n");
+           const string_view query_type = Descriptions::ReadToken(query, " ");
+           // the name is the rest of the line, spaces included
+           const string_view name = query;
+           if (query_type == "Bus") {
+               writer << "Bus " << name << ": ";
+               if (const Bus* bus = GetBus(name)) {
+                   writer << bus->stop_count << " stops on route, " << bus->unique_stop_count << " unique stops, "
+                       << bus->road_route_length << " route length, "
+                       << bus->road_route_length / bus->geo_route_length << " curvature";
+               }
+               else {
+                   writer << "not found";
+               }
+               writer.EndLine();
+           }
+           else if (query_type == "Stop") {
+               writer << "Stop " << name << ": ";
+               if (const Stop* stop = GetStop(name); !stop) {
+                   writer << "not found";
+               }
+               else if (stop->bus_names.empty()) {
+                   writer << "no buses";
+               }
+               else {
+                   writer << "buses";
+                   for (const auto& bus_name : stop->bus_names) {
+                       writer << ' ' << bus_name;
+                   }
+               }
+               writer.EndLine();
+           }
+       }
+       writer.Flush();
+       output.flush();
+   }
+
    void BusManager::ProcessBus(string_view& query_view) const {
        string bus_number = Descriptions::ReadToken(query_view).data();
-       if (auto cur_bus = buses_.find(bus_number); cur_bus != buses_.end()) {
-           cout << "Bus " << bus_number << ": " << cur_bus->second.stop_count << " stops on route, " << cur_bus->second.unique_stop_count << " unique stops, "
-               << cur_bus->second.road_route_length << " route length, " << cur_bus->second.road_route_length / cur_bus->second.geo_route_length << " curvature" <<  endl;
+       if (const Bus* cur_bus = GetBus(bus_number)) {
+           cout << "Bus " << bus_number << ": " << cur_bus->stop_count << " stops on route, " << cur_bus->unique_stop_count << " unique stops, "
+               << cur_bus->road_route_length << " route length, " << cur_bus->road_route_length / cur_bus->geo_route_length << " curvature" <<  endl;
        }
        else {
            cout << "Bus " << bus_number << ": not found" << endl;
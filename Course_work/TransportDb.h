@@ -1,12 +1,17 @@
 #pragma once
+#include <deque>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include "descriptions.h"
 #include "utils.h"
 #include <iomanip>
 #include <algorithm>
+#include <mutex>
 #include "json.h"
+#include "map_renderer.h"
+#include "stops_index.h"
 #include "transport_router.h"
 
 namespace Responses {
@@ -24,27 +29,74 @@ namespace Responses {
 
 namespace TransportDataBase {
 
+    enum class BusStatsMode {
+        EAGER,  // all bus stats are computed in the constructor
+        LAZY,  // each bus is computed on its first GetBus, route inputs are kept until then
+    };
+
 	class BusManager {
         using Bus = Responses::Bus;
         using Stop = Responses::Stop;
-        std::unordered_map<std::string, Bus> buses_;
-        std::unordered_map<std::string, Stop> stops_;
+
+        struct BusEntry {
+            std::vector<Descriptions::StopId> stops;  // cleared once the stats are known in eager mode
+            bool is_roundtrip = false;
+            mutable std::once_flag stats_once;
+            mutable Bus stats;
+        };
+
+        // keyed by views into bus_names_ and stop_names_, so a lookup by string_view builds no string;
+        // a deque never moves the strings it holds
+        std::deque<std::string> bus_names_;
+        std::deque<std::string> stop_names_;
+        std::unordered_map<std::string_view, BusEntry> buses_;
+        std::unordered_map<std::string_view, Stop> stops_;
+        // inputs of the bus stats, only kept in lazy mode
+        Descriptions::RoadDistances road_distances_;
+        std::vector<Sphere::UnitVector> stops_vectors_;
         std::unique_ptr<TransportRouter> router_;
+        StopsIndex stops_index_;
+        std::unique_ptr<MapRenderer> map_renderer_;
+        mutable std::once_flag map_once_;
+        mutable Json::SharedString map_;  // stored with std::atomic_store, MemoryReport may run alongside the render
+        // descriptions and the compact network only live during construction, sizes are kept for MemoryReport
+        size_t descriptions_bytes_ = 0;
+        size_t network_bytes_ = 0;
 
-        int ComputeRoadRouteLength(const std::vector<std::string>& stops, const Descriptions::StopsDict& stops_dict);
-        double ComputeGeoRouteDistance(const std::vector<std::string>& stops, const Descriptions::StopsDict& stops_dict);
+        Bus ComputeBusStats(const BusEntry& entry, const Descriptions::RoadDistances& road_distances,
+            const std::vector<Sphere::UnitVector>& stops_vectors) const;
+        int ComputeRoadRouteLength(const RouteView<Descriptions::StopId>& route, const Descriptions::RoadDistances& road_distances) const;
+        double ComputeGeoRouteDistance(const RouteView<Descriptions::StopId>& route, const std::vector<Sphere::UnitVector>& stops_vectors) const;
 
 	public:
-        BusManager(std::vector<Descriptions::InputQuery> queries, const Json::Dict& routing_settings_json);
+        // thread_count > 1 fans per-bus work out across threads, results are identical to the serial build
+        BusManager(std::vector<Descriptions::InputQuery> queries,
+            const Json::Dict& routing_settings_json,
+            const Json::Dict& render_settings_json = {},
+            size_t thread_count = 1,
+            BusStatsMode bus_stats_mode = BusStatsMode::EAGER);
 
-        const Stop* GetStop(const std::string& name) const;
-        const Bus* GetBus(const std::string& name) const;
+        const Stop* GetStop(std::string_view name) const;
+        // Safe to call concurrently, in lazy mode the first call for a bus computes its stats
+        const Bus* GetBus(std::string_view name) const;
 
         std::optional<TransportRouter::RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to) const;
+        std::optional<std::vector<TransportRouter::ReachableStop>> FindReachableStops(const std::string& stop_from, double max_time) const;
+        std::vector<TransportRouter::RouteInfo> FindParetoRoutes(const std::string& stop_from, const std::string& stop_to, size_t max_boardings) const;
+
+        std::vector<StopsIndex::Item> FindNearestStops(Sphere::Point position, size_t count) const;
+        std::vector<StopsIndex::Item> FindStopsInRadius(Sphere::Point position, double radius) const;
+
+        // Estimated heap bytes per structure plus the allocator totals when tracking is enabled
+        Json::Dict MemoryReport() const;
 
-        std::string RenderMap() const;
+        // Rendered on the first call, later calls share the cached document
+        Json::SharedString RenderMap() const;
 
         void ProcessQueries(std::istream& stream = std::cin);
+        // Same protocol and output as ProcessQueries, but the input is read as one block and parsed in place,
+        // and responses are collected in a buffer that is written out in large chunks
+        void ProcessQueriesBatched(std::istream& input = std::cin, std::ostream& output = std::cout) const;
         void ProcessBus(std::string_view& query_view) const;
         void ProcessStop(std::string_view& query_view) const;
 
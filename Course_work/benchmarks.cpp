@@ -0,0 +1,566 @@
+#include "profile.h"
+#include "sphere.h"
+#include "stops_index.h"
+#include "TransportDb.h"
+#include "database_holder.h"
+#include "dijkstra.h"
+#include "mapped_router.h"
+#include "msgpack.h"
+#include "requests.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+    struct City {
+        vector<string> names;
+        vector<Sphere::Point> positions;
+    };
+
+    City MakeRandomCity(size_t stop_count, default_random_engine& gen) {
+        uniform_real_distribution<double> latitude(55.5, 56.0);
+        uniform_real_distribution<double> longitude(37.3, 37.9);
+        City city;
+        for (size_t i = 0; i < stop_count; ++i) {
+            city.names.push_back("Stop " + to_string(i));
+            city.positions.push_back({ latitude(gen), longitude(gen) });
+        }
+        return city;
+    }
+
+    vector<string_view> LinearNearest(const City& city, Sphere::Point position, size_t count) {
+        vector<pair<double, string_view>> distances;
+        distances.reserve(city.names.size());
+        for (size_t i = 0; i < city.names.size(); ++i) {
+            distances.emplace_back(Sphere::Distance(position, city.positions[i]), city.names[i]);
+        }
+        count = min(count, distances.size());
+        partial_sort(distances.begin(), distances.begin() + count, distances.end());
+        vector<string_view> result;
+        for (size_t i = 0; i < count; ++i) {
+            result.push_back(distances[i].second);
+        }
+        return result;
+    }
+
+    size_t LinearInRadiusCount(const City& city, Sphere::Point position, double radius) {
+        return count_if(city.positions.begin(), city.positions.end(), [&](Sphere::Point stop) {
+            return Sphere::Distance(position, stop) <= radius;
+        });
+    }
+
+    void BenchmarkStopsIndex() {
+        const size_t stop_count = 50'000;
+        const size_t query_count = 200;
+        default_random_engine gen(42);
+        const City city = MakeRandomCity(stop_count, gen);
+        const City queries = MakeRandomCity(query_count, gen);
+
+        vector<pair<string_view, Sphere::Point>> stops;
+        for (size_t i = 0; i < stop_count; ++i) {
+            stops.emplace_back(city.names[i], city.positions[i]);
+        }
+
+        StopsIndex index;
+        {
+            LOG_DURATION("StopsIndex build, 50k stops");
+            index = StopsIndex(stops);
+        }
+
+        vector<vector<string_view>> linear_nearest;
+        {
+            LOG_DURATION("NearestStops k=10 linear scan");
+            for (const auto& position : queries.positions) {
+                linear_nearest.push_back(LinearNearest(city, position, 10));
+            }
+        }
+        size_t mismatches = 0;
+        {
+            LOG_DURATION("NearestStops k=10 index");
+            for (size_t i = 0; i < query_count; ++i) {
+                const auto items = index.FindNearest(queries.positions[i], 10);
+                for (size_t j = 0; j < items.size(); ++j) {
+                    mismatches += items[j].name != linear_nearest[i][j];
+                }
+            }
+        }
+
+        size_t linear_total = 0;
+        {
+            LOG_DURATION("StopsInRadius 500m linear scan");
+            for (const auto& position : queries.positions) {
+                linear_total += LinearInRadiusCount(city, position, 500);
+            }
+        }
+        size_t index_total = 0;
+        {
+            LOG_DURATION("StopsInRadius 500m index");
+            for (const auto& position : queries.positions) {
+                index_total += index.FindInRadius(position, 500).size();
+            }
+        }
+
+        cerr << "nearest mismatches: " << mismatches
+            << ", radius hits linear/index: " << linear_total << "/" << index_total << endl;
+    }
+
+    vector<Descriptions::InputQuery> MakeRandomNetwork(const City& city, size_t bus_count, size_t stops_per_bus,
+        default_random_engine& gen) {
+        vector<Descriptions::Stop> stops;
+        for (size_t i = 0; i < city.names.size(); ++i) {
+            stops.push_back({ .name = city.names[i], .position = city.positions[i] });
+        }
+        vector<Descriptions::InputQuery> queries;
+        uniform_int_distribution<size_t> stop_idx(0, city.names.size() - 1);
+        uniform_int_distribution<int> road_distance(500, 3000);
+        for (size_t bus_idx = 0; bus_idx < bus_count; ++bus_idx) {
+            Descriptions::Bus bus{ .name = "Bus " + to_string(bus_idx) };
+            size_t prev_idx = stop_idx(gen);
+            bus.stops.push_back(city.names[prev_idx]);
+            for (size_t i = 1; i < stops_per_bus; ++i) {
+                const size_t next_idx = stop_idx(gen);
+                stops[prev_idx].distances[city.names[next_idx]] = road_distance(gen);
+                bus.stops.push_back(city.names[next_idx]);
+                prev_idx = next_idx;
+            }
+            queries.push_back(move(bus));
+        }
+        for (auto& stop : stops) {
+            queries.push_back(move(stop));
+        }
+        return queries;
+    }
+
+    void BenchmarkRenderMap() {
+        default_random_engine gen(42);
+        const City city = MakeRandomCity(10'000, gen);
+        // a zero budget skips the all-pairs table, only the map matters here
+        const Json::Dict routing_settings = {
+            {"bus_wait_time", Json::Node(6)},
+            {"bus_velocity", Json::Node(40)},
+            {"router_memory_budget_mb", Json::Node(0)},
+        };
+        const TransportDataBase::BusManager db(MakeRandomNetwork(city, 500, 40, gen), routing_settings);
+
+        size_t first_size = 0;
+        {
+            LOG_DURATION("RenderMap first call, 10k stops / 500 buses");
+            first_size = db.RenderMap()->size();
+        }
+        size_t cached_size = 0;
+        {
+            LOG_DURATION("RenderMap cached, 1000 calls");
+            for (int i = 0; i < 1000; ++i) {
+                cached_size += db.RenderMap()->size();
+            }
+        }
+        cerr << "map size: " << first_size << " bytes, cached total: " << cached_size << endl;
+    }
+
+    // Buses hop between nearby stops, like real routes do, so graph adjacency follows geography
+    vector<Descriptions::InputQuery> MakeLocalNetwork(const City& city, size_t bus_count, size_t stops_per_bus,
+        default_random_engine& gen) {
+        vector<pair<string_view, Sphere::Point>> positions;
+        for (size_t i = 0; i < city.names.size(); ++i) {
+            positions.emplace_back(city.names[i], city.positions[i]);
+        }
+        const StopsIndex index(positions);
+        unordered_map<string_view, size_t> stop_idx_by_name;
+        for (size_t i = 0; i < city.names.size(); ++i) {
+            stop_idx_by_name[city.names[i]] = i;
+        }
+
+        vector<Descriptions::Stop> stops;
+        for (size_t i = 0; i < city.names.size(); ++i) {
+            stops.push_back({ .name = city.names[i], .position = city.positions[i] });
+        }
+        vector<Descriptions::InputQuery> queries;
+        uniform_int_distribution<size_t> stop_idx(0, city.names.size() - 1);
+        uniform_int_distribution<size_t> neighbour_idx(1, 6);
+        for (size_t bus_idx = 0; bus_idx < bus_count; ++bus_idx) {
+            Descriptions::Bus bus{ .name = "Bus " + to_string(bus_idx) };
+            size_t prev_idx = stop_idx(gen);
+            bus.stops.push_back(city.names[prev_idx]);
+            for (size_t i = 1; i < stops_per_bus; ++i) {
+                const auto neighbours = index.FindNearest(city.positions[prev_idx], 7);
+                const size_t next_idx = stop_idx_by_name.at(neighbours[min(neighbour_idx(gen), neighbours.size() - 1)].name);
+                stops[prev_idx].distances[city.names[next_idx]] = static_cast<int>(neighbours[0].distance) + 500;
+                bus.stops.push_back(city.names[next_idx]);
+                prev_idx = next_idx;
+            }
+            queries.push_back(move(bus));
+        }
+        for (auto& stop : stops) {
+            queries.push_back(move(stop));
+        }
+        return queries;
+    }
+
+    void PrintLatencies(const string& title, vector<chrono::nanoseconds> latencies) {
+        if (latencies.empty()) {
+            cerr << title << ": no queries" << endl;
+            return;
+        }
+        sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) {
+            const size_t idx = min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+            return chrono::duration_cast<chrono::microseconds>(latencies[idx]).count();
+        };
+        cerr << title << ": " << latencies.size() << " queries, p50 " << percentile(0.5)
+            << " us, p99 " << percentile(0.99) << " us, max " << percentile(1.0) << " us" << endl;
+    }
+
+    void BenchmarkReload() {
+        default_random_engine gen(42);
+        const City city = MakeRandomCity(2'000, gen);
+        const Json::Dict routing_settings = {
+            {"bus_wait_time", Json::Node(6)},
+            {"bus_velocity", Json::Node(40)},
+            {"router_memory_budget_mb", Json::Node(0)},
+        };
+        auto build = [&city, &routing_settings, seed = 0]() mutable {
+            default_random_engine gen(++seed);
+            return make_unique<TransportDataBase::BusManager>(MakeRandomNetwork(city, 100, 40, gen), routing_settings);
+        };
+
+        TransportDataBase::DatabaseHolder holder;
+        holder.Publish(build());
+
+        enum Phase { BEFORE, DURING, AFTER, STOP };
+        atomic<int> phase = BEFORE;
+        vector<chrono::nanoseconds> latencies[STOP];
+        // the reader keeps querying through the reload, each query pins one snapshot
+        thread reader([&] {
+            default_random_engine query_gen(7);
+            uniform_int_distribution<size_t> stop_idx(0, city.names.size() - 1);
+            for (int current; (current = phase.load()) != STOP; ) {
+                const auto start = chrono::steady_clock::now();
+                const auto db = holder.Read();
+                db->FindRoute(city.names[stop_idx(query_gen)], city.names[stop_idx(query_gen)]);
+                latencies[current].push_back(chrono::steady_clock::now() - start);
+            }
+        });
+
+        this_thread::sleep_for(chrono::milliseconds(300));
+        phase = DURING;
+        auto reload = holder.ReloadAsync(build);
+        {
+            LOG_DURATION("Reload build + publish, 2k stops / 100 buses");
+            reload.get();
+        }
+        phase = AFTER;
+        this_thread::sleep_for(chrono::milliseconds(300));
+        phase = STOP;
+        reader.join();
+
+        PrintLatencies("Route before reload", latencies[BEFORE]);
+        PrintLatencies("Route during reload", latencies[DURING]);
+        PrintLatencies("Route after reload", latencies[AFTER]);
+        cerr << "generation: " << holder.GetGeneration() << endl;
+    }
+
+    void BenchmarkMappedRouter() {
+        const size_t vertex_count = 3'000;
+        const size_t query_count = 2'000;
+        default_random_engine gen(42);
+        uniform_int_distribution<Graph::VertexId> vertex(0, vertex_count - 1);
+        uniform_real_distribution<double> weight(1, 100);
+        Graph::DirectedWeightedGraph<double> graph(vertex_count);
+        for (Graph::VertexId from = 0; from < vertex_count; ++from) {
+            for (int i = 0; i < 10; ++i) {
+                graph.AddEdge({ from, vertex(gen), weight(gen) });
+            }
+        }
+        vector<pair<Graph::VertexId, Graph::VertexId>> queries(query_count);
+        for (auto& [from, to] : queries) {
+            from = vertex(gen);
+            to = vertex(gen);
+        }
+
+        // per process, so concurrent runs do not share a table; the MappedFile inside removes it,
+        // also when the benchmark throws
+        const string path = (filesystem::temp_directory_path()
+            / ("transport_router_table." + to_string(getpid()) + ".bin")).string();
+        optional<Graph::MappedRouter<double>> router;
+        {
+            LOG_DURATION("MappedRouter precompute, 3k vertices");
+            router.emplace(graph, path);
+        }
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < 200; ++i) {
+            const auto expected = Graph::FindShortestPath(graph, queries[i].first, queries[i].second);
+            const auto actual = router->BuildRoute(queries[i].first, queries[i].second);
+            mismatches += expected.has_value() != actual.has_value()
+                || (expected && abs(expected->weight - actual->weight) > 1e-9);
+        }
+
+        auto run_queries = [&] {
+            size_t edge_count = 0;
+            for (const auto& [from, to] : queries) {
+                if (const auto route = router->BuildRoute(from, to)) {
+                    edge_count += route->edges.size();
+                }
+            }
+            return edge_count;
+        };
+        router->DropPageCache();
+        size_t cold_edges = 0;
+        {
+            LOG_DURATION("MappedRouter 2000 routes, cold page cache");
+            cold_edges = run_queries();
+        }
+        size_t warm_edges = 0;
+        {
+            LOG_DURATION("MappedRouter 2000 routes, warm page cache");
+            warm_edges = run_queries();
+        }
+        cerr << "table file: " << Graph::MappedRouter<double>::EstimateFileBytes(vertex_count) / (1024 * 1024)
+            << " MiB, mismatches vs Dijkstra: " << mismatches
+            << ", route edges cold/warm: " << cold_edges << "/" << warm_edges << endl;
+        router.reset();
+    }
+
+    void BenchmarkResponseEncoding() {
+        default_random_engine gen(42);
+        const City city = MakeRandomCity(2'000, gen);
+        const Json::Dict routing_settings = {
+            {"bus_wait_time", Json::Node(6)},
+            {"bus_velocity", Json::Node(40)},
+            {"router_memory_budget_mb", Json::Node(0)},
+        };
+        const TransportDataBase::BusManager db(MakeRandomNetwork(city, 100, 20, gen), routing_settings);
+
+        vector<Json::Node> requests;
+        uniform_int_distribution<size_t> stop_idx(0, city.names.size() - 1);
+        uniform_int_distribution<size_t> bus_idx(0, 99);
+        for (int i = 0; i < 3'000; ++i) {
+            Json::Dict request = { {"id", Json::Node(i)} };
+            if (i % 3 == 0) {
+                request["type"] = Json::Node("Stop"s);
+                request["name"] = Json::Node(city.names[stop_idx(gen)]);
+            }
+            else if (i % 3 == 1) {
+                request["type"] = Json::Node("Bus"s);
+                request["name"] = Json::Node("Bus " + to_string(bus_idx(gen)));
+            }
+            else {
+                request["type"] = Json::Node("Route"s);
+                request["from"] = Json::Node(city.names[stop_idx(gen)]);
+                request["to"] = Json::Node(city.names[stop_idx(gen)]);
+            }
+            requests.emplace_back(move(request));
+        }
+        const auto responses = Requests::ProcessAll(db, requests);
+
+        const int repeat_count = 20;
+        string json;
+        {
+            LOG_DURATION("Encode 3000 responses x20, JSON");
+            for (int i = 0; i < repeat_count; ++i) {
+                ostringstream output;
+                Json::PrintValue(responses, output);
+                json = output.str();
+            }
+        }
+        string binary;
+        {
+            LOG_DURATION("Encode 3000 responses x20, MessagePack");
+            for (int i = 0; i < repeat_count; ++i) {
+                binary = MsgPack::Encode(responses);
+            }
+        }
+        {
+            LOG_DURATION("Decode 3000 responses x20, JSON");
+            for (int i = 0; i < repeat_count; ++i) {
+                istringstream input(json);
+                Json::Load(input);
+            }
+        }
+        vector<Json::Node> decoded;
+        {
+            LOG_DURATION("Decode 3000 responses x20, MessagePack");
+            for (int i = 0; i < repeat_count; ++i) {
+                decoded = MsgPack::Decode(binary);
+            }
+        }
+
+        ostringstream decoded_json;
+        Json::PrintValue(decoded, decoded_json);
+        cerr << "size JSON/MessagePack: " << json.size() << "/" << binary.size()
+            << " bytes, round trip " << (decoded_json.str() == json ? "matches" : "DIFFERS") << endl;
+    }
+
+    void BenchmarkLazyBusStats() {
+        default_random_engine gen(42);
+        const City city = MakeRandomCity(10'000, gen);
+        const auto queries = MakeRandomNetwork(city, 2'000, 30, gen);
+        const Json::Dict routing_settings = {
+            {"bus_wait_time", Json::Node(6)},
+            {"bus_velocity", Json::Node(40)},
+            {"router_memory_budget_mb", Json::Node(0)},
+        };
+
+        // best of three alternating runs, the first build of the process pays for warming up the allocator
+        using Mode = TransportDataBase::BusStatsMode;
+        map<Mode, chrono::steady_clock::duration> first_response_times;
+        map<Mode, chrono::steady_clock::duration> all_buses_times;
+        for (int round = 0; round < 3; ++round) {
+            for (const auto mode : { Mode::EAGER, Mode::LAZY }) {
+                const auto start = chrono::steady_clock::now();
+                const TransportDataBase::BusManager db(queries, routing_settings, {}, 1, mode);
+                db.GetBus("Bus 0");
+                const auto first_response = chrono::steady_clock::now();
+                for (int i = 0; i < 2'000; ++i) {
+                    db.GetBus("Bus " + to_string(i));
+                }
+                const auto all_buses = chrono::steady_clock::now();
+
+                auto update_min = [](auto& times, Mode mode, chrono::steady_clock::duration time) {
+                    if (const auto it = times.find(mode); it == times.end() || time < it->second) {
+                        times[mode] = time;
+                    }
+                };
+                update_min(first_response_times, mode, first_response - start);
+                update_min(all_buses_times, mode, all_buses - first_response);
+            }
+        }
+        for (const auto mode : { Mode::EAGER, Mode::LAZY }) {
+            cerr << "Time to first Bus response, " << (mode == Mode::EAGER ? "eager" : "lazy") << ": "
+                << chrono::duration_cast<chrono::milliseconds>(first_response_times[mode]).count()
+                << " ms, then all 2000 buses: "
+                << chrono::duration_cast<chrono::milliseconds>(all_buses_times[mode]).count() << " ms" << endl;
+        }
+    }
+
+    void BenchmarkVertexOrder() {
+        default_random_engine gen(42);
+        const City small_city = MakeRandomCity(500, gen);
+        const auto small_network = MakeLocalNetwork(small_city, 60, 30, gen);
+        const City large_city = MakeRandomCity(10'000, gen);
+        const auto large_network = MakeLocalNetwork(large_city, 1'000, 40, gen);
+
+        auto make_queries = [&gen](const City& city, size_t count) {
+            uniform_int_distribution<size_t> stop_idx(0, city.names.size() - 1);
+            vector<pair<string, string>> queries;
+            for (size_t i = 0; i < count; ++i) {
+                queries.emplace_back(city.names[stop_idx(gen)], city.names[stop_idx(gen)]);
+            }
+            return queries;
+        };
+        const auto small_queries = make_queries(small_city, 20'000);
+        const auto large_queries = make_queries(large_city, 300);
+
+        for (const string order : { "input", "hilbert" }) {
+            Json::Dict routing_settings = {
+                {"bus_wait_time", Json::Node(6)},
+                {"bus_velocity", Json::Node(40)},
+                {"vertex_order", Json::Node(order)},
+            };
+            double total_time = 0;
+            {
+                optional<TransportDataBase::BusManager> db;
+                {
+                    LOG_DURATION("Build with all-pairs router, 500 stops, " + order + " order");
+                    db.emplace(small_network, routing_settings);
+                }
+                LOG_DURATION("20000 routes, all-pairs router, " + order + " order");
+                for (const auto& [from, to] : small_queries) {
+                    if (const auto route = db->FindRoute(from, to)) {
+                        total_time += route->total_time;
+                    }
+                }
+            }
+            {
+                routing_settings["router_memory_budget_mb"] = Json::Node(0);
+                const TransportDataBase::BusManager db(large_network, routing_settings);
+                LOG_DURATION("300 routes, Dijkstra, 10k stops, " + order + " order");
+                for (const auto& [from, to] : large_queries) {
+                    if (const auto route = db.FindRoute(from, to)) {
+                        total_time += route->total_time;
+                    }
+                }
+            }
+            cerr << "total route time checksum, " << order << " order: " << total_time << endl;
+        }
+    }
+
+    void BenchmarkTextQueries() {
+        default_random_engine gen(42);
+        const City city = MakeRandomCity(2'000, gen);
+        const Json::Dict routing_settings = {
+            {"bus_wait_time", Json::Node(6)},
+            {"bus_velocity", Json::Node(40)},
+            {"router_memory_budget_mb", Json::Node(0)},
+        };
+        TransportDataBase::BusManager db(MakeRandomNetwork(city, 100, 20, gen), routing_settings);
+
+        const size_t query_count = 500'000;
+        string input = to_string(query_count) + "\n";
+        uniform_int_distribution<size_t> stop_idx(0, city.names.size() - 1);
+        uniform_int_distribution<size_t> bus_idx(0, 120);
+        for (size_t i = 0; i < query_count; ++i) {
+            input += i % 2 ? "Stop " + city.names[stop_idx(gen)] : "Bus " + to_string(bus_idx(gen));
+            input += '\n';
+        }
+
+        // both paths write to a real file descriptor, so per-line flushes cost what they cost in production
+        ofstream null_output("/dev/null");
+        auto* const cout_buffer = cout.rdbuf(null_output.rdbuf());
+        {
+            istringstream stream(input);
+            LOG_DURATION("500k text queries, getline + endl");
+            db.ProcessQueries(stream);
+        }
+        cout.rdbuf(cout_buffer);
+        {
+            istringstream stream(input);
+            LOG_DURATION("500k text queries, batched");
+            db.ProcessQueriesBatched(stream, null_output);
+        }
+
+        ostringstream expected;
+        cout.rdbuf(expected.rdbuf());
+        {
+            istringstream stream(input);
+            db.ProcessQueries(stream);
+        }
+        cout.rdbuf(cout_buffer);
+        ostringstream actual;
+        {
+            istringstream stream(input);
+            db.ProcessQueriesBatched(stream, actual);
+        }
+        cerr << "text output " << expected.str().size() << " bytes, batched output "
+            << (actual.str() == expected.str() ? "matches" : "DIFFERS") << endl;
+    }
+}
+
+void RunBenchmarks() {
+    BenchmarkStopsIndex();
+    BenchmarkRenderMap();
+    BenchmarkReload();
+    BenchmarkMappedRouter();
+    BenchmarkResponseEncoding();
+    BenchmarkLazyBusStats();
+    BenchmarkVertexOrder();
+    BenchmarkTextQueries();
+}
@@ -0,0 +1,148 @@
+#include "database_holder.h"
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace TransportDataBase {
+
+    unique_ptr<BusManager> MakeBusManager(const Json::Dict& input_map, size_t thread_count, BusStatsMode bus_stats_mode) {
+        const auto render_settings_it = input_map.find("render_settings");
+        return make_unique<BusManager>(
+            Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
+            input_map.at("routing_settings").AsMap(),
+            render_settings_it != input_map.end() ? render_settings_it->second.AsMap() : Json::Dict{},
+            thread_count,
+            bus_stats_mode
+        );
+    }
+
+    namespace {
+        // where a thread starts looking for a free reader slot, different threads rarely meet
+        size_t GetHomeSlot() {
+            static atomic<size_t> next_home = 0;
+            thread_local const size_t home = next_home.fetch_add(1, memory_order_relaxed);
+            return home;
+        }
+    }
+
+    DatabaseHolder::ReadGuard::ReadGuard(atomic<uint64_t>* slot, const BusManager* db)
+        : slot_(slot)
+        , db_(db)
+    {
+    }
+
+    DatabaseHolder::ReadGuard::ReadGuard(ReadGuard&& other) noexcept
+        : slot_(exchange(other.slot_, nullptr))
+        , db_(exchange(other.db_, nullptr))
+    {
+    }
+
+    DatabaseHolder::ReadGuard::~ReadGuard() {
+        if (slot_) {
+            // release: the reader's last use of the instance happens before a publisher sees the slot idle
+            slot_->store(IDLE, memory_order_release);
+        }
+    }
+
+    DatabaseHolder::DatabaseHolder(unique_ptr<const BusManager> db)
+        : current_(db.release())
+    {
+    }
+
+    DatabaseHolder::~DatabaseHolder() {
+        // no reader may outlive the holder
+        delete current_.load(memory_order_relaxed);
+    }
+
+    DatabaseHolder::ReadGuard DatabaseHolder::Read() const {
+        const size_t home = GetHomeSlot();
+        for (size_t probe = 0; ; ++probe) {
+            atomic<uint64_t>& slot = slots_[(home + probe) % READER_SLOT_COUNT].epoch;
+            uint64_t announced = epoch_.load();
+            uint64_t expected = IDLE;
+            if (slot.load(memory_order_relaxed) != IDLE || !slot.compare_exchange_strong(expected, announced)) {
+                if ((probe + 1) % READER_SLOT_COUNT == 0) {
+                    this_thread::yield();  // every slot is busy
+                }
+                continue;
+            }
+            // A publisher that advanced the epoch in between may have scanned the slots before
+            // our announcement landed, announce again until the epoch stays put
+            for (uint64_t epoch; (epoch = epoch_.load()) != announced; announced = epoch) {
+                slot.store(epoch);
+            }
+            return ReadGuard(&slot, current_.load(memory_order_acquire));
+        }
+    }
+
+    void DatabaseHolder::Publish(unique_ptr<const BusManager> db) {
+        const BusManager* previous = current_.exchange(db.release(), memory_order_acq_rel);
+        // readers announcing this epoch or a later one can only load the new instance
+        const uint64_t last_epoch = epoch_.fetch_add(1);
+        lock_guard guard(retired_mutex_);
+        if (previous) {
+            retired_.push_back({ last_epoch, unique_ptr<const BusManager>(previous) });
+        }
+        Reclaim();
+    }
+
+    bool DatabaseHolder::Reclaim() {
+        uint64_t oldest_pinned = UINT64_MAX;
+        for (const ReaderSlot& slot : slots_) {
+            const uint64_t epoch = slot.epoch.load();
+            if (epoch != IDLE) {
+                oldest_pinned = min(oldest_pinned, epoch);
+            }
+        }
+        // destroyed here, on the publishing thread
+        auto still_visible = retired_.begin();
+        for (auto& retired : retired_) {
+            if (retired.last_epoch >= oldest_pinned) {
+                *still_visible++ = move(retired);
+            }
+        }
+        retired_.erase(still_visible, retired_.end());
+        return !retired_.empty();
+    }
+
+    void DatabaseHolder::WaitForReaders() {
+        for (;;) {
+            {
+                lock_guard guard(retired_mutex_);
+                if (!Reclaim()) {
+                    return;
+                }
+            }
+            // queries are short, the previous instance is usually free after the first wait
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    size_t DatabaseHolder::GetGeneration() const {
+        return epoch_.load(memory_order_acquire) - 1;
+    }
+
+    future<void> DatabaseHolder::ReloadAsync(function<unique_ptr<BusManager>()> build) {
+        return async(launch::async, [this, build = move(build)] {
+            STATS_PHASE("reload");
+            Publish(build());
+            WaitForReaders();
+        });
+    }
+
+    future<void> DatabaseHolder::ReloadFromFile(string path, size_t thread_count, BusStatsMode bus_stats_mode) {
+        return ReloadAsync([path = move(path), thread_count, bus_stats_mode] {
+            ifstream input(path);
+            if (!input) {
+                throw runtime_error("cannot open " + path);
+            }
+            const auto document = Json::Load(input);
+            return MakeBusManager(document.GetRoot().AsMap(), thread_count, bus_stats_mode);
+        });
+    }
+
+}
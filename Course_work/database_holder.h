@@ -0,0 +1,98 @@
+#pragma once
+
+#include "TransportDb.h"
+#include "json.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace TransportDataBase {
+
+    // Builds a BusManager from a whole input document: base_requests, routing_settings and optional render_settings
+    std::unique_ptr<BusManager> MakeBusManager(const Json::Dict& input_map, size_t thread_count = 1,
+        BusStatsMode bus_stats_mode = BusStatsMode::EAGER);
+
+    // Publishes the current BusManager for concurrent readers with epoch-based reclamation.
+    // The instance sits behind an atomic raw pointer. A reader announces the current epoch in a slot
+    // of its own, loads the pointer and clears the slot when its query is done: a handful of atomic
+    // operations and no lock, lock-free as long as fewer than READER_SLOT_COUNT readers are active at once.
+    // Publish swaps the pointer, advances the epoch and retires the previous instance, which is
+    // destroyed by the publishing thread once no slot holds an epoch it was current in, never by a reader.
+    // The program itself builds one instance and never reloads, this is used by the --bench reload benchmark.
+    class DatabaseHolder {
+    public:
+        static const size_t READER_SLOT_COUNT = 64;
+
+        // Keeps the instance that was current when it was taken alive until destroyed, meant for one query
+        class ReadGuard {
+        public:
+            ReadGuard(ReadGuard&& other) noexcept;
+            ReadGuard& operator=(ReadGuard&&) = delete;
+            ~ReadGuard();
+
+            // null if nothing was published yet
+            const BusManager* Get() const { return db_; }
+            const BusManager* operator->() const { return db_; }
+            const BusManager& operator*() const { return *db_; }
+
+        private:
+            friend class DatabaseHolder;
+            ReadGuard(std::atomic<uint64_t>* slot, const BusManager* db);
+
+            std::atomic<uint64_t>* slot_;
+            const BusManager* db_;
+        };
+
+        explicit DatabaseHolder(std::unique_ptr<const BusManager> db = nullptr);
+        ~DatabaseHolder();
+
+        DatabaseHolder(const DatabaseHolder&) = delete;
+        DatabaseHolder& operator=(const DatabaseHolder&) = delete;
+
+        ReadGuard Read() const;
+        // Publishes db and frees the retired instances no reader can still see. Safe to call concurrently.
+        void Publish(std::unique_ptr<const BusManager> db);
+        // Bumped on every Publish, lets readers notice that they are working on an old instance
+        size_t GetGeneration() const;
+
+        // Runs build on a background thread, publishes the result and waits there until readers
+        // have left the previous instance, so the old one is destroyed on that thread as well.
+        // If build throws, the current instance stays published and the future rethrows.
+        // The future comes from std::async: keep it, a discarded one blocks in its destructor
+        // until the reload is done, which turns the call into a synchronous one.
+        [[nodiscard]] std::future<void> ReloadAsync(std::function<std::unique_ptr<BusManager>()> build);
+        [[nodiscard]] std::future<void> ReloadFromFile(std::string path, size_t thread_count = 1,
+            BusStatsMode bus_stats_mode = BusStatsMode::EAGER);
+
+    private:
+        static const uint64_t IDLE = 0;  // a slot that pins nothing, epochs start at 1
+
+        struct alignas(64) ReaderSlot {
+            std::atomic<uint64_t> epoch = IDLE;
+        };
+
+        struct Retired {
+            uint64_t last_epoch;  // the instance was current up to this epoch
+            std::unique_ptr<const BusManager> db;
+        };
+
+        std::atomic<const BusManager*> current_;
+        std::atomic<uint64_t> epoch_ = 1;
+        mutable std::array<ReaderSlot, READER_SLOT_COUNT> slots_;
+        std::mutex retired_mutex_;  // taken by publishers only
+        std::vector<Retired> retired_;
+
+        // Frees what no reader can see anymore, returns whether anything is still retired. Caller holds retired_mutex_
+        bool Reclaim();
+        void WaitForReaders();
+    };
+
+}
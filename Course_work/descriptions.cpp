@@ -1,4 +1,8 @@
 #include "descriptions.h"
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <charconv>
 
 using namespace std;
 
@@ -24,28 +28,30 @@ namespace Descriptions {
         return lhs;
     }
 
-    int ConvertToInt(string_view str) {
-        // use std::from_chars when available to git rid of string copy
-        size_t pos;
-        const int result = stoi(string(str), &pos);
-        if (pos != str.length()) {
+    template <typename Number>
+    static Number ConvertToNumber(string_view str) {
+        Number result{};
+        const auto [ptr, error_code] = from_chars(str.data(), str.data() + str.size(), result);
+        if (error_code == errc::result_out_of_range) {
+            throw out_of_range("string " + string(str) + " is out of range");
+        }
+        if (error_code != errc{}) {
+            throw invalid_argument("string " + string(str) + " is not a number");
+        }
+        if (ptr != str.data() + str.size()) {
             std::stringstream error;
-            error << "string " << str << " contains " << (str.length() - pos) << " trailing chars";
+            error << "string " << str << " contains " << (str.data() + str.size() - ptr) << " trailing chars";
             throw invalid_argument(error.str());
         }
         return result;
     }
 
+    int ConvertToInt(string_view str) {
+        return ConvertToNumber<int>(str);
+    }
+
     double ConvertToDouble(string_view str) {
-        // use std::from_chars when available to git rid of string copy
-        size_t pos;
-        const double result = stod(string(str), &pos);
-        if (pos != str.length()) {
-            std::stringstream error;
-            error << "string " << str << " contains " << (str.length() - pos) << " trailing chars";
-            throw invalid_argument(error.str());
-        }
-        return result;
+        return ConvertToNumber<double>(str);
     }
 
     Stop Stop::ParseStop(const Json::Dict& attrs) {
@@ -64,29 +70,106 @@ namespace Descriptions {
         return stop;
     }
 
-    vector<string> ParseStops(const std::vector<Json::Node>& stop_nodes, bool is_roundtrip) {
+    vector<string> ParseStops(const std::vector<Json::Node>& stop_nodes) {
         vector<string> stops;
         stops.reserve(stop_nodes.size());
         for (const Json::Node& stop_node : stop_nodes) {
             stops.push_back(stop_node.AsString());
         }
-        if (is_roundtrip || stops.size() <= 1) {
-            return stops;
-        }
-        stops.reserve(stops.size() * 2 - 1);
-        for (size_t stop_idx = stops.size() - 1; stop_idx > 0; --stop_idx) {
-            stops.push_back(stops[stop_idx - 1]);
-        }
         return stops;
     }
 
+    RouteView<string> Bus::GetRoute() const {
+        return { stops, is_roundtrip };
+    }
+
     Bus Bus::ParseBus(const Json::Dict& attrs) {
         return Bus{
             .name = attrs.at("name").AsString(),
-            .stops = ParseStops(attrs.at("stops").AsArray(), attrs.at("is_roundtrip").AsBool()),
+            .stops = ParseStops(attrs.at("stops").AsArray()),
+            .is_roundtrip = attrs.at("is_roundtrip").AsBool(),
         };
     }
 
+    RoadDistances::RoadDistances(const vector<const Stop*>& stops, const unordered_map<string_view, StopId>& stop_ids) {
+        vector<vector<Neighbour>> rows(stops.size());
+        for (StopId stop_id = 0; stop_id < stops.size(); ++stop_id) {
+            const Stop& stop = *stops[stop_id];
+            for (const auto& [neighbour_name, distance] : stop.distances) {
+                const auto neighbour_it = stop_ids.find(neighbour_name);
+                if (neighbour_it == stop_ids.end()) {
+                    continue;
+                }
+                const StopId neighbour_id = neighbour_it->second;
+                rows[stop_id].push_back({ neighbour_id, distance });
+                if (stops[neighbour_id]->distances.count(stop.name) == 0) {
+                    rows[neighbour_id].push_back({ stop_id, distance });
+                }
+            }
+        }
+
+        offsets_.reserve(stops.size() + 1);
+        offsets_.push_back(0);
+        for (auto& row : rows) {
+            sort(row.begin(), row.end(), [](const Neighbour& lhs, const Neighbour& rhs) {
+                return lhs.stop_id < rhs.stop_id;
+            });
+            neighbours_.insert(neighbours_.end(), row.begin(), row.end());
+            offsets_.push_back(static_cast<uint32_t>(neighbours_.size()));
+        }
+    }
+
+    int RoadDistances::Get(StopId from, StopId to) const {
+        const auto first = neighbours_.begin() + offsets_.at(from);
+        const auto last = neighbours_.begin() + offsets_.at(from + 1);
+        const auto it = lower_bound(first, last, to, [](const Neighbour& neighbour, StopId stop_id) {
+            return neighbour.stop_id < stop_id;
+        });
+        if (it == last || it->stop_id != to) {
+            throw out_of_range("no road distance between stops");
+        }
+        return it->distance;
+    }
+
+    size_t RoadDistances::GetHeapBytes() const {
+        return Memory::VectorBytes(offsets_) + Memory::VectorBytes(neighbours_);
+    }
+
+    RouteView<StopId> CompactBus::GetRoute() const {
+        return { stops, bus->is_roundtrip };
+    }
+
+    CompactNetwork CompactNetwork::Build(const StopsDict& stops_dict, const BusesDict& buses_dict) {
+        CompactNetwork network;
+        network.stops.reserve(stops_dict.size());
+        network.stop_ids.reserve(stops_dict.size());
+        for (const auto& [name, stop] : stops_dict) {
+            network.stop_ids[name] = static_cast<StopId>(network.stops.size());
+            network.stops.push_back(stop);
+        }
+        network.road_distances = RoadDistances(network.stops, network.stop_ids);
+
+        network.buses.reserve(buses_dict.size());
+        for (const auto& [_, bus] : buses_dict) {
+            CompactBus compact_bus = { .bus = bus };
+            compact_bus.stops.reserve(bus->stops.size());
+            for (const string& stop_name : bus->stops) {
+                compact_bus.stops.push_back(network.stop_ids.at(stop_name));
+            }
+            network.buses.push_back(move(compact_bus));
+        }
+        return network;
+    }
+
+    size_t CompactNetwork::GetHeapBytes() const {
+        size_t result = Memory::VectorBytes(stops) + Memory::HashTableBytes(stop_ids)
+            + Memory::VectorBytes(buses) + road_distances.GetHeapBytes();
+        for (const auto& bus : buses) {
+            result += Memory::VectorBytes(bus.stops);
+        }
+        return result;
+    }
+
     ostream& operator<<(ostream& stream, const Stop& stop) {
         stream << stop.name << ": " << stop.position.latitude << " " << stop.position.longitude << endl;
         return stream;
@@ -94,7 +177,7 @@ namespace Descriptions {
 
     ostream& operator<<(ostream& stream, const Bus& bus) {
         stream << bus.name << ": ";
-        for (auto& item : bus.stops) {
+        for (auto& item : bus.GetRoute()) {
             stream << item << ", ";
         }
         stream << endl;
@@ -111,6 +194,26 @@ namespace Descriptions {
     }
 
 
+    size_t EstimateHeapBytes(const vector<InputQuery>& queries) {
+        size_t result = Memory::VectorBytes(queries);
+        for (const auto& query : queries) {
+            if (const auto* stop = get_if<Stop>(&query)) {
+                result += Memory::HeapBytes(stop->name) + Memory::HashTableBytes(stop->distances);
+                for (const auto& [name, _] : stop->distances) {
+                    result += Memory::HeapBytes(name);
+                }
+            }
+            else {
+                const auto& bus = get<Bus>(query);
+                result += Memory::HeapBytes(bus.name) + Memory::VectorBytes(bus.stops);
+                for (const auto& name : bus.stops) {
+                    result += Memory::HeapBytes(name);
+                }
+            }
+        }
+        return result;
+    }
+
     std::vector<Descriptions::InputQuery> ReadDescriptions(const vector<Json::Node>& nodes) {
 
         vector<InputQuery> result;
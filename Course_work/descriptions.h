@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <cstdint>
 #include <cassert>
 #include <cstdlib>
 #include <ctime>
@@ -26,7 +27,10 @@ namespace Descriptions {
 
 	struct Bus {
 		std::string name;
-		std::vector<std::string> stops;
+		std::vector<std::string> stops;  // as listed in the input, a linear route is not mirrored
+		bool is_roundtrip = false;
+
+		RouteView<std::string> GetRoute() const;
 
 		static Bus ParseBus(const Json::Dict& attrs);
 	};
@@ -45,13 +49,60 @@ namespace Descriptions {
 	double ConvertToDouble(std::string_view str);
 	int ComputeStopsDistance(const Stop& lhs, const Stop& rhs);
 
-	std::vector<std::string> ParseStops(const std::vector<Json::Node>& stop_nodes, bool is_roundtrip);
+	std::vector<std::string> ParseStops(const std::vector<Json::Node>& stop_nodes);
 	template <typename Object>
 	using Dict = std::unordered_map<std::string, const Object*>;
 
 	using StopsDict = Dict<Stop>;
 	using BusesDict = Dict<Bus>;
 
+	using StopId = uint32_t;
+
+	struct CompactBus {
+		const Bus* bus;
+		std::vector<StopId> stops;
+
+		RouteView<StopId> GetRoute() const;
+	};
+
+	// Road distances of all stops in CSR layout, the reverse direction fallback
+	// of ComputeStopsDistance is resolved once while building
+	class RoadDistances {
+	public:
+		RoadDistances() = default;
+		RoadDistances(const std::vector<const Stop*>& stops, const std::unordered_map<std::string_view, StopId>& stop_ids);
+
+		// throws std::out_of_range for stops without a known road distance
+		int Get(StopId from, StopId to) const;
+
+		size_t GetHeapBytes() const;
+
+	private:
+		struct Neighbour {
+			StopId stop_id;
+			int distance;
+		};
+
+		// neighbours of stop i are neighbours_[offsets_[i], offsets_[i + 1]), sorted by stop_id
+		std::vector<uint32_t> offsets_;
+		std::vector<Neighbour> neighbours_;
+	};
+
+	// Stops and buses with names resolved to dense ids once, so that route walks are array probes
+	struct CompactNetwork {
+		std::vector<const Stop*> stops;  // indexed by StopId
+		std::unordered_map<std::string_view, StopId> stop_ids;
+		std::vector<CompactBus> buses;
+		RoadDistances road_distances;
+
+		// Stop ids follow stops_dict iteration order, buses follow buses_dict iteration order
+		static CompactNetwork Build(const StopsDict& stops_dict, const BusesDict& buses_dict);
+
+		size_t GetHeapBytes() const;
+	};
+
 
 	std::vector<Descriptions::InputQuery> ReadDescriptions(const std::vector<Json::Node>& nodes);
+
+	size_t EstimateHeapBytes(const std::vector<InputQuery>& queries);
 }
\ No newline at end of file
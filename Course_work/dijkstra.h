@@ -0,0 +1,135 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+    template <typename Weight>
+    struct Path {
+        Weight weight;
+        std::vector<EdgeId> edges;
+    };
+
+    // Single-pair Dijkstra: no precomputed state, O(E log V) per query.
+    // Used instead of Router when its V x V table does not fit the memory budget.
+    template <typename Weight>
+    std::optional<Path<Weight>> FindShortestPath(const DirectedWeightedGraph<Weight>& graph, VertexId from, VertexId to) {
+        const size_t vertex_count = graph.GetVertexCount();
+        std::vector<std::optional<Weight>> weights(vertex_count);
+        std::vector<std::optional<EdgeId>> prev_edges(vertex_count);
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+        weights[from] = Weight{};
+        queue.push({ Weight{}, from });
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (weight > *weights[vertex]) {
+                continue;
+            }
+            if (vertex == to) {
+                break;
+            }
+            for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+                const auto& edge = graph.GetEdge(edge_id);
+                const Weight candidate_weight = weight + edge.weight;
+                if (!weights[edge.to] || candidate_weight < *weights[edge.to]) {
+                    weights[edge.to] = candidate_weight;
+                    prev_edges[edge.to] = edge_id;
+                    queue.push({ candidate_weight, edge.to });
+                }
+            }
+        }
+
+        if (!weights[to]) {
+            return std::nullopt;
+        }
+        Path<Weight> path = { *weights[to], {} };
+        for (VertexId vertex = to; vertex != from; vertex = graph.GetEdge(*prev_edges[vertex]).from) {
+            path.edges.push_back(*prev_edges[vertex]);
+        }
+        std::reverse(path.edges.begin(), path.edges.end());
+        return path;
+    }
+
+    // One-to-all Dijkstra, prev_edges[v] is the last edge of the shortest path to v
+    template <typename Weight>
+    struct ShortestPathTree {
+        std::vector<std::optional<Weight>> weights;
+        std::vector<std::optional<EdgeId>> prev_edges;
+    };
+
+    template <typename Weight>
+    ShortestPathTree<Weight> BuildShortestPathTree(const DirectedWeightedGraph<Weight>& graph, VertexId from) {
+        const size_t vertex_count = graph.GetVertexCount();
+        ShortestPathTree<Weight> tree = { std::vector<std::optional<Weight>>(vertex_count), std::vector<std::optional<EdgeId>>(vertex_count) };
+        auto& weights = tree.weights;
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+        weights[from] = Weight{};
+        queue.push({ Weight{}, from });
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (weight > *weights[vertex]) {
+                continue;
+            }
+            for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+                const auto& edge = graph.GetEdge(edge_id);
+                const Weight candidate_weight = weight + edge.weight;
+                if (!weights[edge.to] || candidate_weight < *weights[edge.to]) {
+                    weights[edge.to] = candidate_weight;
+                    tree.prev_edges[edge.to] = edge_id;
+                    queue.push({ candidate_weight, edge.to });
+                }
+            }
+        }
+        return tree;
+    }
+
+    // Vertices reachable from `from` with total weight at most max_weight, ordered by weight.
+    // Tentative weights live in a hash map, so the cost depends on the reached area only, not on the graph size.
+    template <typename Weight>
+    std::vector<std::pair<VertexId, Weight>> FindReachableVertices(const DirectedWeightedGraph<Weight>& graph,
+        VertexId from, Weight max_weight) {
+        std::unordered_map<VertexId, Weight> weights;
+        std::vector<std::pair<VertexId, Weight>> reached;
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+        weights[from] = Weight{};
+        queue.push({ Weight{}, from });
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (weight > weights.at(vertex)) {
+                continue;
+            }
+            reached.emplace_back(vertex, weight);
+            for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+                const auto& edge = graph.GetEdge(edge_id);
+                const Weight candidate_weight = weight + edge.weight;
+                if (candidate_weight > max_weight) {
+                    continue;
+                }
+                const auto [it, inserted] = weights.try_emplace(edge.to, candidate_weight);
+                if (inserted || candidate_weight < it->second) {
+                    it->second = candidate_weight;
+                    queue.push({ candidate_weight, edge.to });
+                }
+            }
+        }
+        return reached;
+    }
+
+}
@@ -33,6 +33,8 @@ namespace Graph {
         const Edge<Weight>& GetEdge(EdgeId edge_id) const;
         IncidentEdgesRange GetIncidentEdges(VertexId vertex) const;
 
+        size_t GetHeapBytes() const;
+
     private:
         std::vector<Edge<Weight>> edges_;
         std::vector<IncidenceList> incidence_lists_;
@@ -71,4 +73,13 @@ namespace Graph {
         const auto& edges = incidence_lists_[vertex];
         return { std::begin(edges), std::end(edges) };
     }
+
+    template <typename Weight>
+    size_t DirectedWeightedGraph<Weight>::GetHeapBytes() const {
+        size_t result = edges_.capacity() * sizeof(Edge<Weight>) + incidence_lists_.capacity() * sizeof(IncidenceList);
+        for (const auto& incidence_list : incidence_lists_) {
+            result += incidence_list.capacity() * sizeof(EdgeId);
+        }
+        return result;
+    }
 }
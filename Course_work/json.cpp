@@ -51,7 +51,16 @@ namespace Json {
 
     Node LoadString(istream& input) {
         string line;
-        getline(input, line, '"');
+        for (char c; input.get(c) && c != '"'; ) {
+            if (c == '\\' && input.get(c)) {
+                switch (c) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                }
+            }
+            line.push_back(c);
+        }
         return Node(move(line));
     }
 
@@ -100,7 +109,23 @@ namespace Json {
 
     template <>
     void PrintValue<string>(const string& value, ostream& output) {
-        output << '"' << value << '"';
+        output << '"';
+        for (const char c : value) {
+            switch (c) {
+            case '"': output << "\\\""; break;
+            case '\\': output << "\\\\"; break;
+            case '\n': output << "\\n"; break;
+            case '\r': output << "\\r"; break;
+            case '\t': output << "\\t"; break;
+            default: output << c;
+            }
+        }
+        output << '"';
+    }
+
+    template <>
+    void PrintValue<SharedString>(const SharedString& value, ostream& output) {
+        PrintValue(*value, output);
     }
 
     template <>
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <variant>
@@ -11,8 +12,10 @@ namespace Json {
 
     class Node;
     using Dict = std::map<std::string, Node>;
+    // A string owned elsewhere, e.g. a cached document put into every response without a copy
+    using SharedString = std::shared_ptr<const std::string>;
 
-    class Node : std::variant<std::vector<Node>, Dict, bool, int, double, std::string> {
+    class Node : std::variant<std::vector<Node>, Dict, bool, int, double, std::string, SharedString> {
     public:
         using variant::variant;
         const variant& GetBase() const { return *this; }
@@ -24,7 +27,12 @@ namespace Json {
         double AsDouble() const {
             return std::holds_alternative<double>(*this) ? std::get<double>(*this) : std::get<int>(*this);
         }
-        const auto& AsString() const { return std::get<std::string>(*this); }
+        bool IsString() const {
+            return std::holds_alternative<std::string>(*this) || std::holds_alternative<SharedString>(*this);
+        }
+        const std::string& AsString() const {
+            return std::holds_alternative<SharedString>(*this) ? *std::get<SharedString>(*this) : std::get<std::string>(*this);
+        }
     };
 
     class Document {
@@ -53,6 +61,9 @@ namespace Json {
     template <>
     void PrintValue<std::string>(const std::string& value, std::ostream& output);
 
+    template <>
+    void PrintValue<SharedString>(const SharedString& value, std::ostream& output);
+
     template <>
     void PrintValue<bool>(const bool& value, std::ostream& output);
 
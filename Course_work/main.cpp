@@ -1,19 +1,108 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include "TransportDb.h"
+#include "database_holder.h"
+#include "msgpack.h"
 #include "requests.h"
+#include "stats.h"
 
 
 using namespace std;
 
-int main() {
-	const auto input_doc = Json::Load(cin);
-	const auto& input_map = input_doc.GetRoot().AsMap();
+void RunBenchmarks();
 
-	const TransportDataBase::BusManager db(Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()), input_map.at("routing_settings").AsMap());
+// Reads a --msgpack response document from stdin and prints it as JSON
+int DecodeMessagePack() {
+	const string data{ istreambuf_iterator<char>(cin), istreambuf_iterator<char>() };
+	vector<Json::Node> responses;
+	try {
+		responses = MsgPack::Decode(data);
+	}
+	catch (const invalid_argument& e) {
+		cerr << "invalid MessagePack: " << e.what() << endl;
+		return 1;
+	}
+	Json::PrintValue(responses, cout);
+	cout << endl;
+	return 0;
+}
 
-	Json::PrintValue(Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),cout);
+int main(int argc, char* argv[]) {
+	Stats::EnableFromEnvironment();
+	size_t thread_count = max(1u, thread::hardware_concurrency());
+	bool memory_report = false;
+	bool msgpack_output = false;
+	auto bus_stats_mode = TransportDataBase::BusStatsMode::EAGER;
+	for (int i = 1; i < argc; ++i) {
+		if (argv[i] == "--stats"sv) {
+			Stats::Enable();
+		}
+		else if (argv[i] == "--memory-report"sv) {
+			memory_report = true;
+			Stats::EnableAllocationTracking();
+		}
+		else if (argv[i] == "--lazy-bus-stats"sv) {
+			bus_stats_mode = TransportDataBase::BusStatsMode::LAZY;
+		}
+		else if (argv[i] == "--msgpack"sv) {
+			msgpack_output = true;
+		}
+		else if (argv[i] == "--decode-msgpack"sv) {
+			return DecodeMessagePack();
+		}
+		else if (argv[i] == "--bench"sv) {
+			RunBenchmarks();
+			return 0;
+		}
+		else if (argv[i] == "--threads"sv && i + 1 < argc) {
+			thread_count = max(1, atoi(argv[++i]));
+		}
+	}
 
-	cout << endl;
+	optional<Json::Document> input_doc;
+	{
+		STATS_PHASE("json_load");
+		input_doc = Json::Load(cin);
+	}
+	const auto& input_map = input_doc->GetRoot().AsMap();
+
+	unique_ptr<TransportDataBase::BusManager> db;
+	{
+		STATS_PHASE("bus_manager_build");
+		db = TransportDataBase::MakeBusManager(input_map, thread_count, bus_stats_mode);
+	}
+
+	vector<Json::Node> responses;
+	{
+		STATS_PHASE("process_all");
+		responses = Requests::ProcessAll(*db, input_map.at("stat_requests").AsArray());
+	}
+
+	{
+		STATS_PHASE("print");
+		if (msgpack_output) {
+			const string encoded = MsgPack::Encode(responses);
+			cout.write(encoded.data(), encoded.size());
+		}
+		else {
+			Json::PrintValue(responses, cout);
+			cout << endl;
+		}
+	}
+
+	Stats::Print(cerr);
+	if (memory_report) {
+		Json::PrintValue(db->MemoryReport(), cerr);
+		cerr << endl;
+	}
 
 	return 0;
-} 
\ No newline at end of file
+}
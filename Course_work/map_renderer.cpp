@@ -0,0 +1,138 @@
+#include "map_renderer.h"
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+using namespace std;
+
+MapRenderer::MapRenderer(const Descriptions::CompactNetwork& network, const Json::Dict& render_settings_json)
+    : render_settings_(MakeRenderSettings(render_settings_json))
+{
+    double min_lat = numeric_limits<double>::max();
+    double max_lat = numeric_limits<double>::lowest();
+    double min_lon = numeric_limits<double>::max();
+    double max_lon = numeric_limits<double>::lowest();
+    for (const auto* stop : network.stops) {
+        min_lat = min(min_lat, stop->position.latitude);
+        max_lat = max(max_lat, stop->position.latitude);
+        min_lon = min(min_lon, stop->position.longitude);
+        max_lon = max(max_lon, stop->position.longitude);
+    }
+
+    const double width_zoom = max_lon > min_lon
+        ? (render_settings_.width - 2 * render_settings_.padding) / (max_lon - min_lon)
+        : 0;
+    const double height_zoom = max_lat > min_lat
+        ? (render_settings_.height - 2 * render_settings_.padding) / (max_lat - min_lat)
+        : 0;
+    const double zoom = width_zoom == 0 || height_zoom == 0
+        ? max(width_zoom, height_zoom)
+        : min(width_zoom, height_zoom);
+
+    stops_.reserve(network.stops.size());
+    for (const auto* stop : network.stops) {
+        stops_.push_back({
+            .name = stop->name,
+            .point = {
+                (stop->position.longitude - min_lon) * zoom + render_settings_.padding,
+                (max_lat - stop->position.latitude) * zoom + render_settings_.padding,
+            },
+        });
+    }
+    stops_by_name_.resize(stops_.size());
+    iota(stops_by_name_.begin(), stops_by_name_.end(), Descriptions::StopId{ 0 });
+    sort(stops_by_name_.begin(), stops_by_name_.end(), [this](Descriptions::StopId lhs, Descriptions::StopId rhs) {
+        return stops_[lhs].name < stops_[rhs].name;
+    });
+
+    buses_.reserve(network.buses.size());
+    for (const auto& bus : network.buses) {
+        buses_.push_back({ bus.bus->name, bus.stops, bus.bus->is_roundtrip });
+    }
+    sort(buses_.begin(), buses_.end(), [](const BusInfo& lhs, const BusInfo& rhs) {
+        return lhs.name < rhs.name;
+    });
+}
+
+MapRenderer::RenderSettings MapRenderer::MakeRenderSettings(const Json::Dict& json) {
+    RenderSettings settings;
+    auto read_double = [&json](const char* key, double& value) {
+        if (const auto it = json.find(key); it != json.end()) {
+            value = it->second.AsDouble();
+        }
+    };
+    read_double("width", settings.width);
+    read_double("height", settings.height);
+    read_double("padding", settings.padding);
+    read_double("stop_radius", settings.stop_radius);
+    read_double("line_width", settings.line_width);
+    if (const auto it = json.find("stop_label_font_size"); it != json.end()) {
+        settings.stop_label_font_size = it->second.AsInt();
+    }
+    if (const auto it = json.find("stop_label_offset"); it != json.end()) {
+        const auto& offset = it->second.AsArray();
+        settings.stop_label_offset = { offset.at(0).AsDouble(), offset.at(1).AsDouble() };
+    }
+    if (const auto it = json.find("color_palette"); it != json.end() && !it->second.AsArray().empty()) {
+        settings.color_palette.clear();
+        for (const auto& color : it->second.AsArray()) {
+            settings.color_palette.push_back(color.AsString());
+        }
+    }
+    return settings;
+}
+
+size_t MapRenderer::EstimateDocumentSize() const {
+    size_t result = 256;
+    for (const auto& bus : buses_) {
+        result += 160 + RouteView(bus.stops, bus.is_roundtrip).size() * 16;
+    }
+    for (const auto& stop : stops_) {
+        result += 64 + 160 + stop.name.size();
+    }
+    return result;
+}
+
+size_t MapRenderer::GetHeapBytes() const {
+    size_t result = Memory::VectorBytes(render_settings_.color_palette) + Memory::VectorBytes(stops_)
+        + Memory::VectorBytes(stops_by_name_) + Memory::VectorBytes(buses_);
+    for (const auto& color : render_settings_.color_palette) {
+        result += Memory::HeapBytes(color);
+    }
+    for (const auto& stop : stops_) {
+        result += Memory::HeapBytes(stop.name);
+    }
+    for (const auto& bus : buses_) {
+        result += Memory::HeapBytes(bus.name) + Memory::VectorBytes(bus.stops);
+    }
+    return result;
+}
+
+string MapRenderer::Render() const {
+    Svg::Writer writer(EstimateDocumentSize());
+    writer.BeginDocument();
+
+    const auto& palette = render_settings_.color_palette;
+    for (size_t bus_idx = 0; bus_idx < buses_.size(); ++bus_idx) {
+        const auto& bus = buses_[bus_idx];
+        writer.BeginPolyline(palette[bus_idx % palette.size()], render_settings_.line_width);
+        for (const Descriptions::StopId stop_id : RouteView(bus.stops, bus.is_roundtrip)) {
+            writer.AddPolylinePoint(stops_[stop_id].point);
+        }
+        writer.EndPolyline();
+    }
+
+    for (const Descriptions::StopId stop_id : stops_by_name_) {
+        writer.Circle(stops_[stop_id].point, render_settings_.stop_radius, "white");
+    }
+
+    for (const Descriptions::StopId stop_id : stops_by_name_) {
+        const auto& stop = stops_[stop_id];
+        writer.Text(stop.point, render_settings_.stop_label_offset, render_settings_.stop_label_font_size, "black", stop.name);
+    }
+
+    writer.EndDocument();
+    return writer.Release();
+}
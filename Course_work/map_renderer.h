@@ -0,0 +1,49 @@
+#pragma once
+
+#include "descriptions.h"
+#include "json.h"
+#include "svg.h"
+
+#include <string>
+#include <vector>
+
+// Keeps everything needed to draw the map, with stop coordinates projected once at construction
+class MapRenderer {
+public:
+    MapRenderer(const Descriptions::CompactNetwork& network, const Json::Dict& render_settings_json);
+
+    std::string Render() const;
+
+    size_t GetHeapBytes() const;
+
+private:
+    struct RenderSettings {
+        double width = 1200;
+        double height = 1200;
+        double padding = 50;
+        double stop_radius = 3;
+        double line_width = 4;
+        int stop_label_font_size = 12;
+        Svg::Point stop_label_offset = { 7, -3 };
+        std::vector<std::string> color_palette = { "green", "red", "blue", "brown", "orange" };
+    };
+
+    static RenderSettings MakeRenderSettings(const Json::Dict& json);
+
+    struct StopInfo {
+        std::string name;
+        Svg::Point point;
+    };
+    struct BusInfo {
+        std::string name;
+        std::vector<Descriptions::StopId> stops;
+        bool is_roundtrip;
+    };
+
+    RenderSettings render_settings_;
+    std::vector<StopInfo> stops_;  // indexed by StopId
+    std::vector<Descriptions::StopId> stops_by_name_;
+    std::vector<BusInfo> buses_;  // sorted by name
+
+    size_t EstimateDocumentSize() const;
+};
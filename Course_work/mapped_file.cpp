@@ -0,0 +1,143 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static runtime_error MakeError(const string& action, const string& path) {
+    return runtime_error(action + " " + path + ": " + strerror(errno));
+}
+
+MappedFile::MappedFile(const string& path, size_t size)
+    : path_(path)
+    , size_(size)
+{
+    // a fresh file next to path: a table published there earlier may still be mapped by a live reader,
+    // truncating it in place would pull its pages away
+    string temp_path = path + ".XXXXXX";
+    fd_ = mkstemp(temp_path.data());
+    if (fd_ < 0) {
+        throw MakeError("cannot create", temp_path);
+    }
+    temp_path_ = move(temp_path);
+    if (fchmod(fd_, 0644) != 0 || ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        const auto error = MakeError("cannot resize", temp_path_);
+        Close();
+        throw error;
+    }
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : path_(move(other.path_))
+    , temp_path_(move(other.temp_path_))
+    , fd_(exchange(other.fd_, -1))
+    , size_(exchange(other.size_, 0))
+    , data_(exchange(other.data_, nullptr))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        Close();
+        path_ = move(other.path_);
+        temp_path_ = move(other.temp_path_);
+        other.temp_path_.clear();
+        fd_ = exchange(other.fd_, -1);
+        size_ = exchange(other.size_, 0);
+        data_ = exchange(other.data_, nullptr);
+    }
+    return *this;
+}
+
+void MappedFile::Write(size_t offset, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t written = pwrite(fd_, bytes, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw MakeError("cannot write", path_);
+        }
+        bytes += written;
+        offset += written;
+        size -= written;
+    }
+}
+
+void MappedFile::Map() {
+    // readers holding the table that was at path keep their mapping of the old inode
+    if (rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        throw MakeError("cannot rename " + temp_path_ + " to", path_);
+    }
+    temp_path_.clear();
+    if (size_ == 0) {
+        return;
+    }
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+        throw MakeError("cannot map", path_);
+    }
+    data_ = static_cast<char*>(data);
+    // lookups jump between tiles, readahead would only pull in pages nobody asked for
+    madvise(data_, size_, MADV_RANDOM);
+}
+
+const char* MappedFile::GetData() const {
+    return data_;
+}
+
+size_t MappedFile::GetSize() const {
+    return size_;
+}
+
+const string& MappedFile::GetPath() const {
+    return path_;
+}
+
+void MappedFile::DropPageCache() {
+    fdatasync(fd_);
+    if (data_) {
+        madvise(data_, size_, MADV_DONTNEED);
+    }
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+void MappedFile::Close() {
+    if (data_) {
+        munmap(data_, size_);
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        RemoveFile();
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+// An unpublished file is ours alone. Once published, path may have been taken over by a newer table
+// since, that one is left alone.
+void MappedFile::RemoveFile() {
+    if (!temp_path_.empty()) {
+        unlink(temp_path_.c_str());
+        temp_path_.clear();
+        return;
+    }
+    struct stat path_stat, file_stat;
+    if (stat(path_.c_str(), &path_stat) == 0 && fstat(fd_, &file_stat) == 0
+        && path_stat.st_dev == file_stat.st_dev && path_stat.st_ino == file_stat.st_ino) {
+        unlink(path_.c_str());
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A file written once with pwrite and then mapped read-only, pages are loaded by the OS on first touch.
+// It is written under a temporary name and renamed to its path by Map, so a reader still mapping
+// an earlier file at that path is not disturbed. The file is removed with the object.
+class MappedFile {
+public:
+    MappedFile() = default;
+    // Creates a size-byte temporary file next to path, throws runtime_error on failure
+    MappedFile(const std::string& path, size_t size);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void Write(size_t offset, const void* data, size_t size);
+    // Moves the file to path and maps it for reading, no more writes are allowed afterwards
+    void Map();
+
+    const char* GetData() const;
+    size_t GetSize() const;
+    const std::string& GetPath() const;
+
+    // Evicts the file from the page cache so the next reads hit the disk again
+    void DropPageCache();
+
+private:
+    std::string path_;
+    std::string temp_path_;  // empty once the file is at path_
+    int fd_ = -1;
+    size_t size_ = 0;
+    char* data_ = nullptr;
+
+    void Close();
+    void RemoveFile();
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "dijkstra.h"
+#include "graph.h"
+#include "mapped_file.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Graph {
+
+    // All-pairs shortest paths stored in a memory-mapped file instead of the heap.
+    // The V x V table is cut into TILE_SIZE x TILE_SIZE tiles, each tile is contiguous in the file,
+    // so nearby (from, to) pairs share pages. The precompute runs one Dijkstra per source,
+    // TILE_SIZE sources at a time, and writes every finished band of tiles straight to the file:
+    // the heap only ever holds one band.
+    template <typename Weight>
+    class MappedRouter {
+    private:
+        using Graph = DirectedWeightedGraph<Weight>;
+
+    public:
+        static const size_t TILE_SIZE = 64;
+
+        MappedRouter(const Graph& graph, const std::string& path, size_t thread_count = 1);
+
+        std::optional<Path<Weight>> BuildRoute(VertexId from, VertexId to) const;
+
+        static size_t EstimateFileBytes(size_t vertex_count);
+        size_t GetFileBytes() const;
+
+        void DropPageCache();
+
+    private:
+        struct Entry {
+            Weight weight;
+            uint32_t prev_edge;
+        };
+        static const uint32_t NO_EDGE = std::numeric_limits<uint32_t>::max();
+        static const uint32_t UNREACHABLE = NO_EDGE - 1;
+
+        const Graph& graph_;
+        size_t tiles_per_row_;
+        MappedFile file_;
+
+        static size_t GetTilesPerRow(size_t vertex_count) {
+            return (vertex_count + TILE_SIZE - 1) / TILE_SIZE;
+        }
+
+        size_t GetEntryOffset(VertexId from, VertexId to) const {
+            const size_t tile_idx = from / TILE_SIZE * tiles_per_row_ + to / TILE_SIZE;
+            const size_t entry_idx = from % TILE_SIZE * TILE_SIZE + to % TILE_SIZE;
+            return (tile_idx * TILE_SIZE * TILE_SIZE + entry_idx) * sizeof(Entry);
+        }
+
+        Entry GetEntry(VertexId from, VertexId to) const {
+            Entry entry;
+            std::memcpy(&entry, file_.GetData() + GetEntryOffset(from, to), sizeof(entry));
+            return entry;
+        }
+    };
+
+
+    template <typename Weight>
+    MappedRouter<Weight>::MappedRouter(const Graph& graph, const std::string& path, size_t thread_count)
+        : graph_(graph)
+        , tiles_per_row_(GetTilesPerRow(graph.GetVertexCount()))
+        , file_(path, EstimateFileBytes(graph.GetVertexCount()))
+    {
+        if (graph.GetEdgeCount() >= UNREACHABLE) {
+            throw std::length_error("too many edges for a mapped route table");
+        }
+        const size_t vertex_count = graph.GetVertexCount();
+        std::vector<Entry> band(TILE_SIZE * tiles_per_row_ * TILE_SIZE, Entry{ Weight{}, UNREACHABLE });
+        for (size_t band_idx = 0; band_idx < tiles_per_row_; ++band_idx) {
+            const VertexId first_source = band_idx * TILE_SIZE;
+            const size_t source_count = std::min(TILE_SIZE, vertex_count - first_source);
+            ForEachChunkParallel(source_count, thread_count, [&](size_t first, size_t last) {
+                for (size_t source_offset = first; source_offset < last; ++source_offset) {
+                    const auto tree = BuildShortestPathTree(graph, first_source + source_offset);
+                    for (VertexId to = 0; to < vertex_count; ++to) {
+                        Entry& entry = band[(to / TILE_SIZE * TILE_SIZE + source_offset) * TILE_SIZE + to % TILE_SIZE];
+                        if (!tree.weights[to]) {
+                            entry = { Weight{}, UNREACHABLE };
+                        }
+                        else {
+                            entry = { *tree.weights[to], tree.prev_edges[to] ? static_cast<uint32_t>(*tree.prev_edges[to]) : NO_EDGE };
+                        }
+                    }
+                }
+            });
+            // the band buffer is already laid out tile after tile, exactly as in the file
+            file_.Write(band_idx * band.size() * sizeof(Entry), band.data(), band.size() * sizeof(Entry));
+        }
+        file_.Map();
+    }
+
+    template <typename Weight>
+    std::optional<Path<Weight>> MappedRouter<Weight>::BuildRoute(VertexId from, VertexId to) const {
+        const Entry route_entry = GetEntry(from, to);
+        if (route_entry.prev_edge == UNREACHABLE) {
+            return std::nullopt;
+        }
+        Path<Weight> path = { route_entry.weight, {} };
+        for (uint32_t edge_id = route_entry.prev_edge; edge_id != NO_EDGE; edge_id = GetEntry(from, graph_.GetEdge(edge_id).from).prev_edge) {
+            path.edges.push_back(edge_id);
+        }
+        std::reverse(path.edges.begin(), path.edges.end());
+        return path;
+    }
+
+    template <typename Weight>
+    size_t MappedRouter<Weight>::EstimateFileBytes(size_t vertex_count) {
+        const size_t tiles_per_row = GetTilesPerRow(vertex_count);
+        return tiles_per_row * tiles_per_row * TILE_SIZE * TILE_SIZE * sizeof(Entry);
+    }
+
+    template <typename Weight>
+    size_t MappedRouter<Weight>::GetFileBytes() const {
+        return file_.GetSize();
+    }
+
+    template <typename Weight>
+    void MappedRouter<Weight>::DropPageCache() {
+        file_.DropPageCache();
+    }
+
+}
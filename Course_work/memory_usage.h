@@ -0,0 +1,44 @@
+#pragma once
+
+#include "json.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Rough heap footprint of standard containers, used by the memory report.
+// Node sizes follow the usual libstdc++/MSVC layouts and ignore allocator rounding.
+namespace Memory {
+    // Heap bytes owned by a string, zero when it fits the small string buffer
+    inline size_t HeapBytes(const std::string& s) {
+        const char* data = s.data();
+        const char* self = reinterpret_cast<const char*>(&s);
+        if (data >= self && data < self + sizeof(s)) {
+            return 0;
+        }
+        return s.capacity() + 1;
+    }
+
+    template <typename T>
+    size_t VectorBytes(const std::vector<T>& items) {
+        return items.capacity() * sizeof(T);
+    }
+
+    // Bucket array plus one node per element (value, next pointer, cached hash)
+    template <typename HashTable>
+    size_t HashTableBytes(const HashTable& table) {
+        return table.bucket_count() * sizeof(void*)
+            + table.size() * (sizeof(typename HashTable::value_type) + 2 * sizeof(void*));
+    }
+
+    // One red-black node per element: colour and three pointers before the value
+    template <typename Tree>
+    size_t TreeBytes(const Tree& tree) {
+        return tree.size() * (sizeof(typename Tree::value_type) + 4 * sizeof(void*));
+    }
+
+    // Json::Node holds int, so reports are printed in whole KiB, rounded up
+    inline Json::Node AsKibNode(size_t bytes) {
+        return Json::Node(static_cast<int>((bytes + 1023) / 1024));
+    }
+}
@@ -0,0 +1,366 @@
+#include "msgpack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace MsgPack {
+
+    namespace {
+        class Encoder {
+        public:
+            explicit Encoder(const vector<Json::Node>& responses) {
+                for (const auto& node : responses) {
+                    CollectNames(node);
+                }
+            }
+
+            string Encode(const vector<Json::Node>& responses) {
+                WriteArrayHeader(2);
+                WriteArrayHeader(names_.size());
+                for (const string_view name : names_) {
+                    WriteString(name);
+                }
+                WriteArrayHeader(responses.size());
+                for (const auto& node : responses) {
+                    WriteNode(node);
+                }
+                return move(buffer_);
+            }
+
+        private:
+            string buffer_;
+            vector<string_view> names_;
+            unordered_map<string_view, uint32_t> name_ids_;
+
+            void CollectName(string_view name) {
+                if (name_ids_.try_emplace(name, static_cast<uint32_t>(names_.size())).second) {
+                    names_.push_back(name);
+                }
+            }
+
+            void CollectNames(const Json::Node& node) {
+                if (node.IsString()) {
+                    CollectName(node.AsString());
+                }
+                else if (holds_alternative<vector<Json::Node>>(node.GetBase())) {
+                    for (const auto& item : node.AsArray()) {
+                        CollectNames(item);
+                    }
+                }
+                else if (holds_alternative<Json::Dict>(node.GetBase())) {
+                    for (const auto& [key, value] : node.AsMap()) {
+                        CollectName(key);
+                        CollectNames(value);
+                    }
+                }
+            }
+
+            void WriteByte(uint8_t byte) {
+                buffer_.push_back(static_cast<char>(byte));
+            }
+
+            template <typename Int>
+            void WriteBigEndian(Int value) {
+                for (int shift = (sizeof(Int) - 1) * 8; shift >= 0; shift -= 8) {
+                    WriteByte(static_cast<uint8_t>(static_cast<uint64_t>(value) >> shift));
+                }
+            }
+
+            void WriteSized(uint8_t fix_tag, size_t fix_limit, uint8_t tag16, size_t size) {
+                if (size < fix_limit) {
+                    WriteByte(static_cast<uint8_t>(fix_tag | size));
+                }
+                else if (size <= UINT16_MAX) {
+                    WriteByte(tag16);
+                    WriteBigEndian(static_cast<uint16_t>(size));
+                }
+                else {
+                    WriteByte(tag16 + 1);
+                    WriteBigEndian(static_cast<uint32_t>(size));
+                }
+            }
+
+            void WriteArrayHeader(size_t size) {
+                WriteSized(0x90, 16, 0xdc, size);
+            }
+
+            void WriteMapHeader(size_t size) {
+                WriteSized(0x80, 16, 0xde, size);
+            }
+
+            void WriteString(string_view value) {
+                if (value.size() < 32) {
+                    WriteByte(static_cast<uint8_t>(0xa0 | value.size()));
+                }
+                else if (value.size() <= UINT8_MAX) {
+                    WriteByte(0xd9);
+                    WriteByte(static_cast<uint8_t>(value.size()));
+                }
+                else if (value.size() <= UINT16_MAX) {
+                    WriteByte(0xda);
+                    WriteBigEndian(static_cast<uint16_t>(value.size()));
+                }
+                else {
+                    WriteByte(0xdb);
+                    WriteBigEndian(static_cast<uint32_t>(value.size()));
+                }
+                buffer_.append(value);
+            }
+
+            void WriteName(string_view name) {
+                const uint32_t id = name_ids_.at(name);
+                if (id <= UINT8_MAX) {
+                    WriteByte(0xd4);
+                    WriteByte(NAME_EXT_TYPE);
+                    WriteByte(static_cast<uint8_t>(id));
+                }
+                else if (id <= UINT16_MAX) {
+                    WriteByte(0xd5);
+                    WriteByte(NAME_EXT_TYPE);
+                    WriteBigEndian(static_cast<uint16_t>(id));
+                }
+                else {
+                    WriteByte(0xd6);
+                    WriteByte(NAME_EXT_TYPE);
+                    WriteBigEndian(id);
+                }
+            }
+
+            void WriteInt(int value) {
+                if (value >= 0 && value < 128) {
+                    WriteByte(static_cast<uint8_t>(value));
+                }
+                else if (value < 0 && value >= -32) {
+                    WriteByte(static_cast<uint8_t>(static_cast<int8_t>(value)));
+                }
+                else if (value >= INT8_MIN && value <= INT8_MAX) {
+                    WriteByte(0xd0);
+                    WriteBigEndian(static_cast<int8_t>(value));
+                }
+                else if (value >= INT16_MIN && value <= INT16_MAX) {
+                    WriteByte(0xd1);
+                    WriteBigEndian(static_cast<int16_t>(value));
+                }
+                else {
+                    WriteByte(0xd2);
+                    WriteBigEndian(static_cast<int32_t>(value));
+                }
+            }
+
+            void WriteDouble(double value) {
+                uint64_t bits;
+                static_assert(sizeof(bits) == sizeof(value));
+                memcpy(&bits, &value, sizeof(bits));
+                WriteByte(0xcb);
+                WriteBigEndian(bits);
+            }
+
+            void WriteNode(const Json::Node& node) {
+                const auto& base = node.GetBase();
+                if (holds_alternative<vector<Json::Node>>(base)) {
+                    WriteArrayHeader(node.AsArray().size());
+                    for (const auto& item : node.AsArray()) {
+                        WriteNode(item);
+                    }
+                }
+                else if (holds_alternative<Json::Dict>(base)) {
+                    WriteMapHeader(node.AsMap().size());
+                    for (const auto& [key, value] : node.AsMap()) {
+                        WriteName(key);
+                        WriteNode(value);
+                    }
+                }
+                else if (holds_alternative<bool>(base)) {
+                    WriteByte(node.AsBool() ? 0xc3 : 0xc2);
+                }
+                else if (holds_alternative<int>(base)) {
+                    WriteInt(node.AsInt());
+                }
+                else if (holds_alternative<double>(base)) {
+                    WriteDouble(node.AsDouble());
+                }
+                else {
+                    WriteName(node.AsString());
+                }
+            }
+        };
+
+        class Decoder {
+        public:
+            explicit Decoder(string_view data)
+                : data_(data)
+            {
+            }
+
+            vector<Json::Node> Decode() {
+                if (ReadArraySize(ReadByte()) != 2) {
+                    throw invalid_argument("expected [names, responses]");
+                }
+                const size_t name_count = ReadArraySize(ReadByte());
+                // every item takes at least a byte, a larger count is caught by Require later on
+                names_.reserve(min(name_count, GetRemaining()));
+                for (size_t i = 0; i < name_count; ++i) {
+                    names_.push_back(ReadString(ReadByte()));
+                }
+                const size_t response_count = ReadArraySize(ReadByte());
+                vector<Json::Node> responses;
+                responses.reserve(min(response_count, GetRemaining()));
+                for (size_t i = 0; i < response_count; ++i) {
+                    responses.push_back(ReadNode(1));
+                }
+                if (pos_ != data_.size()) {
+                    throw invalid_argument("trailing bytes after responses");
+                }
+                return responses;
+            }
+
+        private:
+            string_view data_;
+            size_t pos_ = 0;
+            vector<string> names_;
+
+            size_t GetRemaining() const {
+                return data_.size() - pos_;
+            }
+
+            void Require(size_t size) const {
+                if (GetRemaining() < size) {
+                    throw invalid_argument("unexpected end of data");
+                }
+            }
+
+            uint8_t ReadByte() {
+                Require(1);
+                return static_cast<uint8_t>(data_[pos_++]);
+            }
+
+            template <typename Int>
+            Int ReadBigEndian() {
+                Require(sizeof(Int));
+                uint64_t value = 0;
+                for (size_t i = 0; i < sizeof(Int); ++i) {
+                    value = (value << 8) | static_cast<uint8_t>(data_[pos_++]);
+                }
+                return static_cast<Int>(value);
+            }
+
+            size_t ReadArraySize(uint8_t tag) {
+                if ((tag & 0xf0) == 0x90) {
+                    return tag & 0x0f;
+                }
+                switch (tag) {
+                case 0xdc: return ReadBigEndian<uint16_t>();
+                case 0xdd: return ReadBigEndian<uint32_t>();
+                default: throw invalid_argument("expected an array");
+                }
+            }
+
+            string ReadString(uint8_t tag) {
+                size_t size;
+                if ((tag & 0xe0) == 0xa0) {
+                    size = tag & 0x1f;
+                }
+                else if (tag == 0xd9) {
+                    size = ReadBigEndian<uint8_t>();
+                }
+                else if (tag == 0xda) {
+                    size = ReadBigEndian<uint16_t>();
+                }
+                else if (tag == 0xdb) {
+                    size = ReadBigEndian<uint32_t>();
+                }
+                else {
+                    throw invalid_argument("expected a string");
+                }
+                Require(size);
+                string result(data_.substr(pos_, size));
+                pos_ += size;
+                return result;
+            }
+
+            const string& ReadName(uint8_t tag) {
+                if (tag != 0xd4 && tag != 0xd5 && tag != 0xd6) {
+                    throw invalid_argument("expected a name id");
+                }
+                if (static_cast<int8_t>(ReadByte()) != NAME_EXT_TYPE) {
+                    throw invalid_argument("unknown ext type");
+                }
+                uint32_t id;
+                switch (tag) {
+                case 0xd4: id = ReadBigEndian<uint8_t>(); break;
+                case 0xd5: id = ReadBigEndian<uint16_t>(); break;
+                default: id = ReadBigEndian<uint32_t>(); break;
+                }
+                if (id >= names_.size()) {
+                    throw invalid_argument("name id out of range");
+                }
+                return names_[id];
+            }
+
+            // depth counts the arrays and maps around the node
+            Json::Node ReadNode(size_t depth) {
+                const uint8_t tag = ReadByte();
+                if (tag < 0x80) {
+                    return Json::Node(static_cast<int>(tag));
+                }
+                if (tag >= 0xe0) {
+                    return Json::Node(static_cast<int>(static_cast<int8_t>(tag)));
+                }
+                const bool is_array = (tag & 0xf0) == 0x90 || tag == 0xdc || tag == 0xdd;
+                const bool is_map = (tag & 0xf0) == 0x80 || tag == 0xde || tag == 0xdf;
+                if ((is_array || is_map) && depth >= MAX_DEPTH) {
+                    throw invalid_argument("nesting deeper than " + to_string(MAX_DEPTH));
+                }
+                if (is_array) {
+                    const size_t size = ReadArraySize(tag);
+                    vector<Json::Node> items;
+                    items.reserve(min(size, GetRemaining()));
+                    for (size_t i = 0; i < size; ++i) {
+                        items.push_back(ReadNode(depth + 1));
+                    }
+                    return Json::Node(move(items));
+                }
+                if (is_map) {
+                    const size_t size = (tag & 0xf0) == 0x80 ? tag & 0x0f
+                        : tag == 0xde ? ReadBigEndian<uint16_t>() : ReadBigEndian<uint32_t>();
+                    Json::Dict dict;
+                    for (size_t i = 0; i < size; ++i) {
+                        string key = ReadName(ReadByte());
+                        dict.emplace(move(key), ReadNode(depth + 1));
+                    }
+                    return Json::Node(move(dict));
+                }
+                switch (tag) {
+                case 0xc2: return Json::Node(false);
+                case 0xc3: return Json::Node(true);
+                case 0xd0: return Json::Node(static_cast<int>(ReadBigEndian<int8_t>()));
+                case 0xd1: return Json::Node(static_cast<int>(ReadBigEndian<int16_t>()));
+                case 0xd2: return Json::Node(static_cast<int>(ReadBigEndian<int32_t>()));
+                case 0xcb: {
+                    const uint64_t bits = ReadBigEndian<uint64_t>();
+                    double value;
+                    memcpy(&value, &bits, sizeof(value));
+                    return Json::Node(value);
+                }
+                case 0xd4: case 0xd5: case 0xd6:
+                    return Json::Node(ReadName(tag));
+                default:
+                    throw invalid_argument("unsupported tag " + to_string(tag));
+                }
+            }
+        };
+    }
+
+    string Encode(const vector<Json::Node>& responses) {
+        return Encoder(responses).Encode(responses);
+    }
+
+    vector<Json::Node> Decode(string_view data) {
+        return Decoder(data).Decode();
+    }
+
+}
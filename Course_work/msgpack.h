@@ -0,0 +1,29 @@
+#pragma once
+
+#include "json.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary alternative to Json::PrintValue for the response array, valid MessagePack.
+//
+// The document is an array of two items: [names, responses].
+// names is an array of str holding every distinct string of the responses once, in order of first use.
+// responses mirrors the Json tree: arrays and maps as MessagePack arrays and maps, ints with the shortest
+// int encoding, doubles as float64, bools as true/false.
+// Every string, map keys included, is written as an ext of type NAME_EXT_TYPE whose payload is
+// the big-endian index into names: fixext 1, 2 or 4 depending on the index size.
+namespace MsgPack {
+    const int8_t NAME_EXT_TYPE = 1;
+    // Arrays and maps nested deeper than this are rejected by Decode, responses go about six levels deep
+    const size_t MAX_DEPTH = 64;
+
+    std::string Encode(const std::vector<Json::Node>& responses);
+
+    // Inverse of Encode, interned names are resolved back to strings.
+    // Throws std::invalid_argument on malformed input, also when the counts it declares could not fit the data.
+    std::vector<Json::Node> Decode(std::string_view data);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "dijkstra.h"
+#include "graph.h"
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+namespace Graph {
+
+    // Pareto-optimal paths for (total weight, number of counted edges).
+    // Labels are (vertex, counted edges so far) with counted edges capped at max_counted,
+    // so every vertex keeps at most max_counted + 1 labels and a query costs
+    // O((max_counted + 1) * E log V) in the worst case.
+    // The result is ordered by counted edges, each path strictly lighter than the previous one.
+    template <typename Weight, typename IsCounted>
+    std::vector<Path<Weight>> FindParetoPaths(const DirectedWeightedGraph<Weight>& graph,
+        VertexId from, VertexId to, size_t max_counted, IsCounted is_counted) {
+        const size_t layer_count = max_counted + 1;
+        auto state_of = [layer_count](VertexId vertex, size_t counted) {
+            return vertex * layer_count + counted;
+        };
+
+        std::vector<std::optional<Weight>> weights(graph.GetVertexCount() * layer_count);
+        std::vector<std::optional<EdgeId>> prev_edges(weights.size());
+
+        // a label is useless if the same vertex is already reachable as fast with fewer counted edges
+        auto is_dominated = [&](VertexId vertex, size_t counted, Weight weight) {
+            for (size_t other = 0; other < counted; ++other) {
+                const auto& other_weight = weights[state_of(vertex, other)];
+                if (other_weight && *other_weight <= weight) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        // nor is it worth keeping once the target is reached as fast with no more counted edges
+        auto is_hopeless = [&](size_t counted, Weight weight) {
+            for (size_t other = 0; other <= counted; ++other) {
+                const auto& target_weight = weights[state_of(to, other)];
+                if (target_weight && *target_weight <= weight) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        using QueueItem = std::tuple<Weight, size_t, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+        weights[state_of(from, 0)] = Weight{};
+        queue.push({ Weight{}, 0, from });
+        while (!queue.empty()) {
+            const auto [weight, counted, vertex] = queue.top();
+            queue.pop();
+            if (weight > *weights[state_of(vertex, counted)] || is_dominated(vertex, counted, weight)) {
+                continue;
+            }
+            if (vertex == to) {
+                continue;
+            }
+            for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+                const auto& edge = graph.GetEdge(edge_id);
+                const size_t next_counted = counted + (is_counted(edge_id) ? 1 : 0);
+                if (next_counted > max_counted) {
+                    continue;
+                }
+                const Weight candidate_weight = weight + edge.weight;
+                if (is_dominated(edge.to, next_counted, candidate_weight) || is_hopeless(next_counted, candidate_weight)) {
+                    continue;
+                }
+                auto& target_weight = weights[state_of(edge.to, next_counted)];
+                if (!target_weight || candidate_weight < *target_weight) {
+                    target_weight = candidate_weight;
+                    prev_edges[state_of(edge.to, next_counted)] = edge_id;
+                    queue.push({ candidate_weight, next_counted, edge.to });
+                }
+            }
+        }
+
+        std::vector<Path<Weight>> paths;
+        for (size_t counted = 0; counted < layer_count; ++counted) {
+            const auto& weight = weights[state_of(to, counted)];
+            if (!weight || (!paths.empty() && !(*weight < paths.back().weight))) {
+                continue;
+            }
+            Path<Weight> path = { *weight, {} };
+            VertexId vertex = to;
+            size_t vertex_counted = counted;
+            while (const auto& edge_id = prev_edges[state_of(vertex, vertex_counted)]) {
+                path.edges.push_back(*edge_id);
+                vertex_counted -= is_counted(*edge_id) ? 1 : 0;
+                vertex = graph.GetEdge(*edge_id).from;
+            }
+            std::reverse(path.edges.begin(), path.edges.end());
+            paths.push_back(std::move(path));
+        }
+        return paths;
+    }
+
+}
@@ -1,5 +1,9 @@
 #include "requests.h"
+#include "stats.h"
 
+#include <algorithm>
+#include <chrono>
+#include <string>
 #include <vector>
 
 using namespace std;
@@ -58,6 +62,15 @@ namespace Requests {
         }
     };
 
+    static Json::Node MakeRouteItemsNode(const TransportRouter::RouteInfo& route) {
+        vector<Json::Node> items;
+        items.reserve(route.items.size());
+        for (const auto& item : route.items) {
+            items.push_back(visit(RouteItemResponseBuilder{}, item));
+        }
+        return items;
+    }
+
     Json::Dict Route::Process(const TransportDataBase::BusManager& db) const {
         Json::Dict dict;
         const auto route = db.FindRoute(stop_from, stop_to);
@@ -66,19 +79,92 @@ namespace Requests {
         }
         else {
             dict["total_time"] = Json::Node(route->total_time);
-            vector<Json::Node> items;
-            items.reserve(route->items.size());
-            for (const auto& item : route->items) {
-                items.push_back(visit(RouteItemResponseBuilder{}, item));
-            }
+            dict["items"] = MakeRouteItemsNode(*route);
+        }
 
-            dict["items"] = move(items);
+        return dict;
+    }
+
+    Json::Dict ParetoRoute::Process(const TransportDataBase::BusManager& db) const {
+        Json::Dict dict;
+        if (max_boardings > TransportRouter::MAX_PARETO_BOARDINGS) {
+            dict["error_message"] = Json::Node("max_boardings above " + to_string(TransportRouter::MAX_PARETO_BOARDINGS));
+            return dict;
+        }
+        const auto routes = db.FindParetoRoutes(stop_from, stop_to, max_boardings);
+        if (routes.empty()) {
+            dict["error_message"] = Json::Node("not found"s);
+            return dict;
+        }
+
+        vector<Json::Node> route_nodes;
+        route_nodes.reserve(routes.size());
+        for (const auto& route : routes) {
+            const auto boarding_count = count_if(route.items.begin(), route.items.end(), [](const auto& item) {
+                return holds_alternative<TransportRouter::RouteInfo::BusItem>(item);
+            });
+            route_nodes.push_back(Json::Dict{
+                {"total_time", Json::Node(route.total_time)},
+                {"boarding_count", Json::Node(static_cast<int>(boarding_count))},
+                {"items", MakeRouteItemsNode(route)},
+            });
+        }
+        dict["routes"] = move(route_nodes);
+        return dict;
+    }
+
+    Json::Dict Isochrone::Process(const TransportDataBase::BusManager& db) const {
+        Json::Dict dict;
+        const auto stops = db.FindReachableStops(stop_from, max_time);
+        if (!stops) {
+            dict["error_message"] = Json::Node("not found"s);
+            return dict;
         }
 
+        vector<Json::Node> stop_nodes;
+        stop_nodes.reserve(stops->size());
+        for (const auto& stop : *stops) {
+            stop_nodes.push_back(Json::Dict{
+                {"stop_name", Json::Node(string(stop.stop_name))},
+                {"time", Json::Node(stop.time)},
+            });
+        }
+        dict["stops"] = move(stop_nodes);
         return dict;
     }
 
-    variant<Stop, Bus, Route> Read(const Json::Dict& attrs) {
+    Json::Dict Map::Process(const TransportDataBase::BusManager& db) const {
+        return Json::Dict{ {"map", Json::Node(db.RenderMap())} };
+    }
+
+    static Json::Dict MakeStopsResponse(const vector<StopsIndex::Item>& stops) {
+        vector<Json::Node> stop_nodes;
+        stop_nodes.reserve(stops.size());
+        for (const auto& stop : stops) {
+            stop_nodes.push_back(Json::Dict{
+                {"name", Json::Node(string(stop.name))},
+                {"distance", Json::Node(stop.distance)},
+            });
+        }
+        return Json::Dict{ {"stops", Json::Node(move(stop_nodes))} };
+    }
+
+    Json::Dict NearestStops::Process(const TransportDataBase::BusManager& db) const {
+        return MakeStopsResponse(db.FindNearestStops(position, count));
+    }
+
+    Json::Dict StopsInRadius::Process(const TransportDataBase::BusManager& db) const {
+        return MakeStopsResponse(db.FindStopsInRadius(position, radius));
+    }
+
+    static Sphere::Point ReadPosition(const Json::Dict& attrs) {
+        return {
+            .latitude = attrs.at("latitude").AsDouble(),
+            .longitude = attrs.at("longitude").AsDouble()
+        };
+    }
+
+    Request Read(const Json::Dict& attrs) {
         const string& type = attrs.at("type").AsString();
         if (type == "Bus") {
             return Bus{ attrs.at("name").AsString() };
@@ -86,6 +172,30 @@ namespace Requests {
         else if (type == "Stop") {
             return Stop{ attrs.at("name").AsString() };
         }
+        else if (type == "ParetoRoute") {
+            // max_boardings defaults to, and must not exceed, MAX_PARETO_BOARDINGS:
+            // Process answers a larger value with an error instead of a route search that cannot see far enough
+            const auto max_boardings_it = attrs.find("max_boardings");
+            return ParetoRoute{
+                attrs.at("from").AsString(),
+                attrs.at("to").AsString(),
+                max_boardings_it == attrs.end()
+                    ? TransportRouter::MAX_PARETO_BOARDINGS
+                    : static_cast<size_t>(max(0, max_boardings_it->second.AsInt())),
+            };
+        }
+        else if (type == "Isochrone") {
+            return Isochrone{ attrs.at("from").AsString(), attrs.at("max_time").AsDouble() };
+        }
+        else if (type == "Map") {
+            return Map{};
+        }
+        else if (type == "NearestStops") {
+            return NearestStops{ ReadPosition(attrs), static_cast<size_t>(max(0, attrs.at("count").AsInt())) };
+        }
+        else if (type == "StopsInRadius") {
+            return StopsInRadius{ ReadPosition(attrs), attrs.at("radius").AsDouble() };
+        }
         else {
             return Route{ attrs.at("from").AsString(), attrs.at("to").AsString() };
         }
@@ -94,11 +204,16 @@ namespace Requests {
     vector<Json::Node> ProcessAll(const TransportDataBase::BusManager& db, const vector<Json::Node>& requests) {
         vector<Json::Node> responses;
         responses.reserve(requests.size());
+        const bool collect_stats = Stats::IsEnabled();
         for (const Json::Node& request_node : requests) {
+            const auto start = collect_stats ? chrono::steady_clock::now() : chrono::steady_clock::time_point{};
             Json::Dict dict = visit([&db](const auto& request) {
                     return request.Process(db);
                 },
                 Requests::Read(request_node.AsMap()));
+            if (collect_stats) {
+                Stats::RecordRequest(request_node.AsMap().at("type").AsString(), chrono::steady_clock::now() - start);
+            }
             dict["request_id"] = Json::Node(request_node.AsMap().at("id").AsInt());
             responses.push_back(Json::Node(dict));
         }
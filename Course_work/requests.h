@@ -27,7 +27,42 @@ namespace Requests {
         Json::Dict Process(const TransportDataBase::BusManager& db) const;
     };
 
-    std::variant<Stop, Bus, Route> Read(const Json::Dict& attrs);
+    struct ParetoRoute {
+        std::string stop_from;
+        std::string stop_to;
+        size_t max_boardings;
+
+        Json::Dict Process(const TransportDataBase::BusManager& db) const;
+    };
+
+    struct Isochrone {
+        std::string stop_from;
+        double max_time;  // in minutes
+
+        Json::Dict Process(const TransportDataBase::BusManager& db) const;
+    };
+
+    struct Map {
+        Json::Dict Process(const TransportDataBase::BusManager& db) const;
+    };
+
+    struct NearestStops {
+        Sphere::Point position;
+        size_t count;
+
+        Json::Dict Process(const TransportDataBase::BusManager& db) const;
+    };
+
+    struct StopsInRadius {
+        Sphere::Point position;
+        double radius;  // in meters
+
+        Json::Dict Process(const TransportDataBase::BusManager& db) const;
+    };
+
+    using Request = std::variant<Stop, Bus, Route, ParetoRoute, Isochrone, Map, NearestStops, StopsInRadius>;
+
+    Request Read(const Json::Dict& attrs);
 
     std::vector<Json::Node> ProcessAll(const TransportDataBase::BusManager& db, const std::vector<Json::Node>& requests);
 }
@@ -33,6 +33,10 @@ namespace Graph {
         EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
         void ReleaseRoute(RouteId route_id);
 
+        // Size of the all-pairs table the constructor allocates for a graph with vertex_count vertices
+        static size_t EstimateTableBytes(size_t vertex_count);
+        size_t GetHeapBytes() const;
+
     private:
         const Graph& graph_;
 
@@ -135,4 +139,15 @@ namespace Graph {
         expanded_routes_cache_.erase(route_id);
     }
 
-}
\ No newline at end of file
+    template <typename Weight>
+    size_t Router<Weight>::EstimateTableBytes(size_t vertex_count) {
+        using Row = typename RoutesInternalData::value_type;
+        return vertex_count * sizeof(Row) + vertex_count * vertex_count * sizeof(typename Row::value_type);
+    }
+
+    template <typename Weight>
+    size_t Router<Weight>::GetHeapBytes() const {
+        return EstimateTableBytes(routes_internal_data_.size());
+    }
+
+}
@@ -1,5 +1,7 @@
 #include "sphere.h"
 
+#include <algorithm>
+
 using namespace std;
 
 namespace Sphere {
@@ -21,4 +23,30 @@ namespace Sphere {
 		return	acos(sin(lhsInRadians.latitude) * sin(rhsInRadians.latitude) + cos(lhsInRadians.latitude) 
 					 * cos(rhsInRadians.latitude) * cos(fabs(lhsInRadians.longitude - rhsInRadians.longitude))) * EARTH_RADIUS;
 	}
-}
\ No newline at end of file
+
+	UnitVector UnitVector::FromPoint(Point point) {
+		const Point in_radians = Point::FromDegrees(point.latitude, point.longitude);
+		const double cos_latitude = cos(in_radians.latitude);
+		return {
+			cos_latitude * cos(in_radians.longitude),
+			cos_latitude * sin(in_radians.longitude),
+			sin(in_radians.latitude)
+		};
+	}
+
+	double Distance(const UnitVector& lhs, const UnitVector& rhs) {
+		const double dx = lhs.x - rhs.x;
+		const double dy = lhs.y - rhs.y;
+		const double dz = lhs.z - rhs.z;
+		return ChordToDistance(sqrt(dx * dx + dy * dy + dz * dz));
+	}
+
+	double ChordToDistance(double chord) {
+		return 2 * asin(std::min(chord / 2, 1.0)) * EARTH_RADIUS;
+	}
+
+	double DistanceToChord(double distance) {
+		const double angle = std::clamp(distance / EARTH_RADIUS, 0.0, PI);
+		return 2 * sin(angle / 2);
+	}
+}
@@ -0,0 +1,290 @@
+#include "stats.h"
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <optional>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+namespace {
+    atomic<bool> stats_enabled = false;
+    atomic<bool> allocation_tracking = false;
+    atomic<size_t> allocation_count = 0;
+    atomic<int64_t> live_bytes = 0;
+    atomic<int64_t> peak_live_bytes = 0;
+
+    // Size of the block the allocator actually handed out, 0 where it cannot be queried
+    size_t GetBlockSize(void* ptr) {
+#if defined(__GLIBC__)
+        return malloc_usable_size(ptr);
+#else
+        return 0;
+#endif
+    }
+
+    void TrackAllocation(void* ptr) {
+        allocation_count.fetch_add(1, memory_order_relaxed);
+        const int64_t block_size = GetBlockSize(ptr);
+        const int64_t live = live_bytes.fetch_add(block_size, memory_order_relaxed) + block_size;
+        int64_t peak = peak_live_bytes.load(memory_order_relaxed);
+        while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+        }
+    }
+
+    void TrackDeallocation(void* ptr) {
+        if (ptr) {
+            live_bytes.fetch_sub(GetBlockSize(ptr), memory_order_relaxed);
+        }
+    }
+}
+
+// Allocations are tracked only while stats or memory tracking are enabled,
+// disabled runs pay a single relaxed load per allocation
+void* operator new(size_t size) {
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (!ptr) {
+        throw bad_alloc();
+    }
+    if (allocation_tracking.load(memory_order_relaxed)) {
+        TrackAllocation(ptr);
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (allocation_tracking.load(memory_order_relaxed)) {
+        TrackDeallocation(ptr);
+    }
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+namespace Stats {
+    namespace {
+        struct PhaseInfo {
+            string name;
+            double wall_ms;
+            double cpu_ms;
+            size_t allocations;
+            size_t peak_live_bytes;
+        };
+
+        struct RequestTypeInfo {
+            static const size_t BUCKET_COUNT = 32;
+
+            size_t count = 0;
+            double total_us = 0;
+            double max_us = 0;
+            // bucket i holds requests that took less than 2^i microseconds
+            array<size_t, BUCKET_COUNT> histogram = {};
+
+            void Add(double latency_us) {
+                ++count;
+                total_us += latency_us;
+                max_us = max(max_us, latency_us);
+                size_t bucket = 0;
+                while (bucket + 1 < BUCKET_COUNT && static_cast<double>(1ull << bucket) <= latency_us) {
+                    ++bucket;
+                }
+                ++histogram[bucket];
+            }
+        };
+
+        struct Collector {
+            mutex m;
+            vector<PhaseInfo> phases;
+            optional<GraphInfo> graph;
+            map<string, RequestTypeInfo> requests;
+        };
+
+        Collector& GetCollector() {
+            static Collector collector;
+            return collector;
+        }
+
+        double ToMilliseconds(chrono::steady_clock::duration duration) {
+            return chrono::duration<double, milli>(duration).count();
+        }
+    }
+
+    void Enable() {
+        stats_enabled = true;
+        EnableAllocationTracking();
+    }
+
+    void EnableAllocationTracking() {
+        allocation_tracking = true;
+    }
+
+    bool IsEnabled() {
+        return stats_enabled.load(memory_order_relaxed);
+    }
+
+    void EnableFromEnvironment() {
+        const char* value = getenv("TRANSPORT_STATS");
+        if (value && value != "0"s && value != ""s) {
+            Enable();
+        }
+    }
+
+    void RecordGraph(const GraphInfo& info) {
+        if (!IsEnabled()) {
+            return;
+        }
+        auto& collector = GetCollector();
+        lock_guard guard(collector.m);
+        collector.graph = info;
+    }
+
+    void RecordRequest(const string& type, chrono::steady_clock::duration latency) {
+        if (!IsEnabled()) {
+            return;
+        }
+        auto& collector = GetCollector();
+        lock_guard guard(collector.m);
+        collector.requests[type].Add(chrono::duration<double, micro>(latency).count());
+    }
+
+    size_t GetAllocationCount() {
+        return allocation_count.load(memory_order_relaxed);
+    }
+
+    size_t GetLiveBytes() {
+        // blocks allocated before tracking was enabled may be freed later
+        return static_cast<size_t>(max<int64_t>(0, live_bytes.load(memory_order_relaxed)));
+    }
+
+    size_t GetPeakLiveBytes() {
+        return static_cast<size_t>(max<int64_t>(0, peak_live_bytes.load(memory_order_relaxed)));
+    }
+
+    size_t GetPeakMemoryKb() {
+#if defined(__unix__) || defined(__APPLE__)
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+            return usage.ru_maxrss / 1024;  // bytes on macOS
+#else
+            return usage.ru_maxrss;
+#endif
+        }
+#endif
+        return 0;
+    }
+
+    PhaseTimer::PhaseTimer(string name) : enabled_(IsEnabled()) {
+        if (!enabled_) {
+            return;
+        }
+        name_ = move(name);
+        allocations_start_ = GetAllocationCount();
+        outer_peak_live_bytes_ = static_cast<size_t>(peak_live_bytes.exchange(live_bytes.load(memory_order_relaxed), memory_order_relaxed));
+        cpu_start_ = clock();
+        wall_start_ = chrono::steady_clock::now();
+    }
+
+    PhaseTimer::~PhaseTimer() {
+        if (!enabled_) {
+            return;
+        }
+        const auto wall = chrono::steady_clock::now() - wall_start_;
+        const clock_t cpu = clock() - cpu_start_;
+        const size_t phase_peak = GetPeakLiveBytes();
+        // the enclosing phase's peak covers this one too
+        int64_t peak = peak_live_bytes.load(memory_order_relaxed);
+        const int64_t outer_peak = static_cast<int64_t>(outer_peak_live_bytes_);
+        while (outer_peak > peak && !peak_live_bytes.compare_exchange_weak(peak, outer_peak, memory_order_relaxed)) {
+        }
+        PhaseInfo info = {
+            .name = move(name_),
+            .wall_ms = ToMilliseconds(wall),
+            .cpu_ms = 1000.0 * cpu / CLOCKS_PER_SEC,
+            .allocations = GetAllocationCount() - allocations_start_,
+            .peak_live_bytes = phase_peak,
+        };
+        auto& collector = GetCollector();
+        lock_guard guard(collector.m);
+        collector.phases.push_back(move(info));
+    }
+
+    Json::Node ToJson() {
+        auto& collector = GetCollector();
+        lock_guard guard(collector.m);
+
+        vector<Json::Node> phases;
+        phases.reserve(collector.phases.size());
+        for (const auto& phase : collector.phases) {
+            phases.push_back(Json::Dict{
+                {"name", Json::Node(phase.name)},
+                {"wall_ms", Json::Node(phase.wall_ms)},
+                {"cpu_ms", Json::Node(phase.cpu_ms)},
+                {"allocations", Json::Node(static_cast<int>(phase.allocations))},
+                {"peak_live_kb", Memory::AsKibNode(phase.peak_live_bytes)},
+            });
+        }
+
+        Json::Dict requests;
+        for (const auto& [type, info] : collector.requests) {
+            vector<Json::Node> histogram;
+            for (size_t bucket = 0; bucket < info.histogram.size(); ++bucket) {
+                if (info.histogram[bucket] > 0) {
+                    histogram.push_back(Json::Dict{
+                        {"less_than_us", Json::Node(static_cast<double>(1ull << bucket))},
+                        {"count", Json::Node(static_cast<int>(info.histogram[bucket]))},
+                    });
+                }
+            }
+            requests[type] = Json::Dict{
+                {"count", Json::Node(static_cast<int>(info.count))},
+                {"total_us", Json::Node(info.total_us)},
+                {"mean_us", Json::Node(info.total_us / info.count)},
+                {"max_us", Json::Node(info.max_us)},
+                {"histogram", Json::Node(move(histogram))},
+            };
+        }
+
+        Json::Dict result = {
+            {"phases", Json::Node(move(phases))},
+            {"requests", Json::Node(move(requests))},
+            {"peak_rss_kb", Json::Node(static_cast<int>(GetPeakMemoryKb()))},
+        };
+        if (const auto& graph = collector.graph) {
+            result["graph"] = Json::Dict{
+                {"vertex_count", Json::Node(static_cast<int>(graph->vertex_count))},
+                {"edge_count", Json::Node(static_cast<int>(graph->edge_count))},
+                {"bus_edge_count", Json::Node(static_cast<int>(graph->bus_edge_count))},
+                {"bus_count", Json::Node(static_cast<int>(graph->bus_count))},
+                {"min_edges_per_bus", Json::Node(static_cast<int>(graph->min_edges_per_bus))},
+                {"max_edges_per_bus", Json::Node(static_cast<int>(graph->max_edges_per_bus))},
+                {"mean_edges_per_bus", Json::Node(graph->bus_count == 0 ? 0.0 :
+                    static_cast<double>(graph->bus_edge_count) / graph->bus_count)},
+            };
+        }
+        return result;
+    }
+
+    void Print(ostream& output) {
+        if (!IsEnabled()) {
+            return;
+        }
+        Json::PrintNode(ToJson(), output);
+        output << endl;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "json.h"
+
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Optional run statistics. Everything here is a no-op until Enable() is called,
+// so instrumentation points can stay in the hot code permanently.
+namespace Stats {
+    void Enable();
+    bool IsEnabled();
+
+    // Enables collection if TRANSPORT_STATS is set to anything but "" or "0".
+    void EnableFromEnvironment();
+
+    // Counts allocations and live heap bytes without collecting the rest of the stats,
+    // Enable() turns it on as well
+    void EnableAllocationTracking();
+
+    struct GraphInfo {
+        size_t vertex_count = 0;
+        size_t edge_count = 0;
+        size_t bus_edge_count = 0;
+        size_t bus_count = 0;
+        size_t min_edges_per_bus = 0;
+        size_t max_edges_per_bus = 0;
+    };
+
+    void RecordGraph(const GraphInfo& info);
+    void RecordRequest(const std::string& type, std::chrono::steady_clock::duration latency);
+
+    size_t GetAllocationCount();
+    // Bytes held by operator new blocks allocated since tracking was enabled (glibc only)
+    size_t GetLiveBytes();
+    size_t GetPeakLiveBytes();
+    // Process-wide resident set high-water mark, it only ever grows
+    size_t GetPeakMemoryKb();
+
+    // Measures wall time, cpu time, allocations and the peak of live heap bytes between construction
+    // and destruction. The peak is reset at the start of the phase and merged back into the enclosing
+    // one at the end, so nested phases report their own peak. Phases running concurrently on other
+    // threads contribute to each other's peaks.
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(std::string name);
+        ~PhaseTimer();
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    private:
+        bool enabled_;
+        std::string name_;
+        std::chrono::steady_clock::time_point wall_start_;
+        std::clock_t cpu_start_ = 0;
+        size_t allocations_start_ = 0;
+        size_t outer_peak_live_bytes_ = 0;
+    };
+
+    Json::Node ToJson();
+    void Print(std::ostream& output = std::cerr);
+}
+
+#define STATS_UNIQ_ID_IMPL(lineno) _stats_phase_##lineno
+#define STATS_UNIQ_ID(lineno) STATS_UNIQ_ID_IMPL(lineno)
+
+#define STATS_PHASE(name) \
+        Stats::PhaseTimer STATS_UNIQ_ID(__LINE__){name}
@@ -0,0 +1,165 @@
+#include "stops_index.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace {
+    double GetCoordinate(const Sphere::UnitVector& point, uint8_t axis) {
+        return axis == 0 ? point.x : axis == 1 ? point.y : point.z;
+    }
+
+    double ChordSquared(const Sphere::UnitVector& lhs, const Sphere::UnitVector& rhs) {
+        const double dx = lhs.x - rhs.x;
+        const double dy = lhs.y - rhs.y;
+        const double dz = lhs.z - rhs.z;
+        return dx * dx + dy * dy + dz * dz;
+    }
+}
+
+StopsIndex::StopsIndex(const vector<pair<string_view, Sphere::Point>>& stops) {
+    nodes_.reserve(stops.size());
+    for (const auto& [name, position] : stops) {
+        nodes_.push_back({ Sphere::UnitVector::FromPoint(position), name });
+    }
+    Build(0, nodes_.size());
+}
+
+size_t StopsIndex::GetSize() const {
+    return nodes_.size();
+}
+
+size_t StopsIndex::GetHeapBytes() const {
+    return nodes_.capacity() * sizeof(Node);
+}
+
+void StopsIndex::Build(size_t first, size_t last) {
+    if (last - first <= 1) {
+        return;
+    }
+
+    // Split along the axis with the widest spread: a city occupies a thin patch of the sphere
+    uint8_t axis = 0;
+    double best_spread = -1;
+    for (uint8_t candidate_axis = 0; candidate_axis < 3; ++candidate_axis) {
+        const auto [min_it, max_it] = minmax_element(nodes_.begin() + first, nodes_.begin() + last,
+            [candidate_axis](const Node& lhs, const Node& rhs) {
+                return GetCoordinate(lhs.point, candidate_axis) < GetCoordinate(rhs.point, candidate_axis);
+            });
+        const double spread = GetCoordinate(max_it->point, candidate_axis) - GetCoordinate(min_it->point, candidate_axis);
+        if (spread > best_spread) {
+            best_spread = spread;
+            axis = candidate_axis;
+        }
+    }
+
+    const size_t middle = first + (last - first) / 2;
+    nth_element(nodes_.begin() + first, nodes_.begin() + middle, nodes_.begin() + last,
+        [axis](const Node& lhs, const Node& rhs) {
+            return GetCoordinate(lhs.point, axis) < GetCoordinate(rhs.point, axis);
+        });
+    nodes_[middle].axis = axis;
+
+    Build(first, middle);
+    Build(middle + 1, last);
+}
+
+bool StopsIndex::Candidate::operator<(const Candidate& other) const {
+    return chord_squared < other.chord_squared;
+}
+
+void StopsIndex::SearchNearest(size_t first, size_t last, const Sphere::UnitVector& target,
+    size_t count, vector<Candidate>& heap) const {
+    if (first >= last) {
+        return;
+    }
+    const size_t middle = first + (last - first) / 2;
+    const Node& node = nodes_[middle];
+
+    const Candidate candidate = { ChordSquared(node.point, target), middle };
+    if (heap.size() < count) {
+        heap.push_back(candidate);
+        push_heap(heap.begin(), heap.end());
+    }
+    else if (candidate < heap.front()) {
+        pop_heap(heap.begin(), heap.end());
+        heap.back() = candidate;
+        push_heap(heap.begin(), heap.end());
+    }
+
+    const double diff = GetCoordinate(target, node.axis) - GetCoordinate(node.point, node.axis);
+    const bool go_left_first = diff < 0;
+    if (go_left_first) {
+        SearchNearest(first, middle, target, count, heap);
+    }
+    else {
+        SearchNearest(middle + 1, last, target, count, heap);
+    }
+    if (heap.size() < count || diff * diff < heap.front().chord_squared) {
+        if (go_left_first) {
+            SearchNearest(middle + 1, last, target, count, heap);
+        }
+        else {
+            SearchNearest(first, middle, target, count, heap);
+        }
+    }
+}
+
+void StopsIndex::SearchInRadius(size_t first, size_t last, const Sphere::UnitVector& target,
+    double chord_squared, vector<Candidate>& result) const {
+    if (first >= last) {
+        return;
+    }
+    const size_t middle = first + (last - first) / 2;
+    const Node& node = nodes_[middle];
+
+    if (const double node_chord_squared = ChordSquared(node.point, target); node_chord_squared <= chord_squared) {
+        result.push_back({ node_chord_squared, middle });
+    }
+
+    const double diff = GetCoordinate(target, node.axis) - GetCoordinate(node.point, node.axis);
+    if (diff < 0 || diff * diff <= chord_squared) {
+        SearchInRadius(first, middle, target, chord_squared, result);
+    }
+    if (diff >= 0 || diff * diff <= chord_squared) {
+        SearchInRadius(middle + 1, last, target, chord_squared, result);
+    }
+}
+
+vector<StopsIndex::Item> StopsIndex::MakeItems(vector<Candidate> candidates) const {
+    sort(candidates.begin(), candidates.end(), [this](const Candidate& lhs, const Candidate& rhs) {
+        return make_pair(lhs.chord_squared, nodes_[lhs.node_idx].name) < make_pair(rhs.chord_squared, nodes_[rhs.node_idx].name);
+    });
+    vector<Item> items;
+    items.reserve(candidates.size());
+    for (const Candidate& candidate : candidates) {
+        items.push_back({
+            .name = nodes_[candidate.node_idx].name,
+            .distance = Sphere::ChordToDistance(sqrt(candidate.chord_squared)),
+            });
+    }
+    return items;
+}
+
+vector<StopsIndex::Item> StopsIndex::FindNearest(Sphere::Point position, size_t count) const {
+    vector<Candidate> heap;
+    if (count == 0) {
+        return {};
+    }
+    heap.reserve(min(count, nodes_.size()));
+    SearchNearest(0, nodes_.size(), Sphere::UnitVector::FromPoint(position), count, heap);
+    return MakeItems(move(heap));
+}
+
+vector<StopsIndex::Item> StopsIndex::FindInRadius(Sphere::Point position, double radius) const {
+    if (radius < 0) {
+        return {};
+    }
+    const double chord = Sphere::DistanceToChord(radius);
+    // a radius of half the circumference or more covers the whole sphere, antipodes included
+    const double chord_squared = chord >= 2 ? numeric_limits<double>::infinity() : chord * chord;
+    vector<Candidate> result;
+    SearchInRadius(0, nodes_.size(), Sphere::UnitVector::FromPoint(position), chord_squared, result);
+    return MakeItems(move(result));
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "sphere.h"
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Static k-d tree over stop positions converted to 3D unit vectors.
+// Chord length between unit vectors grows monotonically with great-circle distance,
+// so plain euclidean pruning gives exact spherical answers.
+class StopsIndex {
+public:
+    struct Item {
+        std::string_view name;
+        double distance;  // in meters
+    };
+
+    StopsIndex() = default;
+    // Names are not copied and must outlive the index
+    explicit StopsIndex(const std::vector<std::pair<std::string_view, Sphere::Point>>& stops);
+
+    // Up to count closest stops, ordered by distance
+    std::vector<Item> FindNearest(Sphere::Point position, size_t count) const;
+    // All stops within radius meters, ordered by distance
+    std::vector<Item> FindInRadius(Sphere::Point position, double radius) const;
+
+    size_t GetSize() const;
+    size_t GetHeapBytes() const;
+
+private:
+    struct Node {
+        Sphere::UnitVector point;
+        std::string_view name;
+        uint8_t axis = 0;
+    };
+
+    // Nodes form an implicit balanced tree: the root of [first, last) is at the middle
+    std::vector<Node> nodes_;
+
+    void Build(size_t first, size_t last);
+
+    struct Candidate {
+        double chord_squared;
+        size_t node_idx;
+
+        bool operator<(const Candidate& other) const;
+    };
+
+    void SearchNearest(size_t first, size_t last, const Sphere::UnitVector& target,
+        size_t count, std::vector<Candidate>& heap) const;
+    void SearchInRadius(size_t first, size_t last, const Sphere::UnitVector& target,
+        double chord_squared, std::vector<Candidate>& result) const;
+
+    std::vector<Item> MakeItems(std::vector<Candidate> candidates) const;
+};
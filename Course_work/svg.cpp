@@ -0,0 +1,106 @@
+#include "svg.h"
+
+#include <charconv>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace Svg {
+    Writer::Writer(size_t capacity_hint) {
+        buffer_.reserve(capacity_hint);
+    }
+
+    void Writer::BeginDocument() {
+        Append(R"(<?xml version="1.0" encoding="UTF-8" ?><svg xmlns="http://www.w3.org/2000/svg" version="1.1">)");
+    }
+
+    void Writer::EndDocument() {
+        Append("</svg>");
+    }
+
+    void Writer::Circle(Point center, double radius, string_view fill) {
+        Append(R"(<circle cx=")");
+        Append(center.x);
+        Append(R"(" cy=")");
+        Append(center.y);
+        Append(R"(" r=")");
+        Append(radius);
+        Append(R"(" fill=")");
+        AppendEscaped(fill);
+        Append(R"(" />)");
+    }
+
+    void Writer::BeginPolyline(string_view stroke, double stroke_width) {
+        Append(R"(<polyline fill="none" stroke=")");
+        AppendEscaped(stroke);
+        Append(R"(" stroke-width=")");
+        Append(stroke_width);
+        Append(R"(" stroke-linecap="round" stroke-linejoin="round" points=")");
+        first_polyline_point_ = true;
+    }
+
+    void Writer::AddPolylinePoint(Point point) {
+        if (!first_polyline_point_) {
+            Append(" ");
+        }
+        first_polyline_point_ = false;
+        Append(point.x);
+        Append(",");
+        Append(point.y);
+    }
+
+    void Writer::EndPolyline() {
+        Append(R"(" />)");
+    }
+
+    void Writer::Text(Point point, Point offset, int font_size, string_view fill, string_view data) {
+        Append(R"(<text x=")");
+        Append(point.x);
+        Append(R"(" y=")");
+        Append(point.y);
+        Append(R"(" dx=")");
+        Append(offset.x);
+        Append(R"(" dy=")");
+        Append(offset.y);
+        Append(R"(" font-size=")");
+        Append(static_cast<double>(font_size));
+        Append(R"(" font-family="Verdana" fill=")");
+        AppendEscaped(fill);
+        Append(R"(">)");
+        AppendEscaped(data);
+        Append("</text>");
+    }
+
+    const string& Writer::GetBuffer() const {
+        return buffer_;
+    }
+
+    string Writer::Release() {
+        return move(buffer_);
+    }
+
+    void Writer::Append(string_view text) {
+        buffer_.append(text);
+    }
+
+    void Writer::Append(double value) {
+        // hundredths of a pixel are plenty and keep the shortest representation short
+        char chars[32];
+        const auto result = to_chars(begin(chars), end(chars), round(value * 100) / 100);
+        buffer_.append(chars, result.ptr);
+    }
+
+    void Writer::AppendEscaped(string_view text) {
+        for (const char c : text) {
+            switch (c) {
+            case '&': Append("&amp;"); break;
+            case '<': Append("&lt;"); break;
+            case '>': Append("&gt;"); break;
+            case '"': Append("&quot;"); break;
+            case '\'': Append("&apos;"); break;
+            default: buffer_.push_back(c);
+            }
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace Svg {
+    struct Point {
+        double x = 0;
+        double y = 0;
+    };
+
+    // Appends SVG elements straight into one preallocated string,
+    // numbers are formatted with std::to_chars instead of going through iostreams
+    class Writer {
+    public:
+        explicit Writer(size_t capacity_hint = 0);
+
+        void BeginDocument();
+        void EndDocument();
+
+        void Circle(Point center, double radius, std::string_view fill);
+
+        void BeginPolyline(std::string_view stroke, double stroke_width);
+        void AddPolylinePoint(Point point);
+        void EndPolyline();
+
+        void Text(Point point, Point offset, int font_size, std::string_view fill, std::string_view data);
+
+        const std::string& GetBuffer() const;
+        std::string Release();
+
+    private:
+        std::string buffer_;
+        bool first_polyline_point_ = true;
+
+        void Append(std::string_view text);
+        void Append(double value);
+        void AppendEscaped(std::string_view text);
+    };
+}
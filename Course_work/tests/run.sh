@@ -0,0 +1,39 @@
+#!/bin/bash
+# Feeds every <case>.in in this directory to the transport binary and compares
+# its stdout and stderr with <case>.out. <case>.args, if present, holds extra flags.
+#
+#   cd Course_work && g++ -std=c++17 -O2 -I.. *.cpp -o transport -lpthread
+#   tests/run.sh ./transport
+#
+# Pass --update to rewrite the .out files from the current binary instead.
+
+set -u
+
+binary=$(realpath "${1:?usage: run.sh <binary> [--update]}")
+update=${2:-}
+cd "$(dirname "$0")"
+unset TRANSPORT_STATS
+
+failed=0
+for input in *.in; do
+    name=${input%.in}
+    args=()
+    if [[ -f $name.args ]]; then
+        read -ra args < "$name.args"
+    fi
+    actual=$(mktemp)
+    "$binary" "${args[@]}" < "$input" > "$actual" 2>&1
+    if [[ $update == --update ]]; then
+        mv "$actual" "$name.out"
+        echo "$name updated"
+        continue
+    fi
+    if cmp -s "$actual" "$name.out"; then
+        echo "$name OK"
+    else
+        echo "$name FAILED"
+        failed=1
+    fi
+    rm -f "$actual"
+done
+exit $failed
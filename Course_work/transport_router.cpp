@@ -1,39 +1,153 @@
 #include "transport_router.h"
+#include "dijkstra.h"
+#include "memory_usage.h"
+#include "pareto.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
 
 using namespace std;
 
 
-TransportRouter::TransportRouter(const Descriptions::StopsDict& stops_dict,
-    const Descriptions::BusesDict& buses_dict,
-    const Json::Dict& routing_settings_json)
+TransportRouter::TransportRouter(const Descriptions::CompactNetwork& network,
+    const Json::Dict& routing_settings_json,
+    size_t thread_count)
     : routing_settings_(MakeRoutingSettings(routing_settings_json))
 {
-    const size_t vertex_count = stops_dict.size() * 2;
+    const size_t vertex_count = network.stops.size() * 2;
     vertices_info_.resize(vertex_count);
     graph_ = BusGraph(vertex_count);
 
-    FillGraphWithStops(stops_dict);
-    FillGraphWithBuses(stops_dict, buses_dict);
+    {
+        STATS_PHASE("graph_build");
+        FillGraphWithStops(network);
+        FillGraphWithBuses(network, thread_count);
+    }
+    if (Stats::IsEnabled()) {
+        Stats::RecordGraph(MakeGraphInfo(network));
+    }
+
+    if (routing_settings_.router_table_file) {
+        STATS_PHASE("router_precompute");
+        mapped_router_ = make_unique<Graph::MappedRouter<double>>(graph_, *routing_settings_.router_table_file, thread_count);
+        return;
+    }
 
+    // Project the all-pairs table before allocating it: over budget we answer with Dijkstra instead
+    const auto& budget = routing_settings_.router_memory_budget;
+    if (budget && Router::EstimateTableBytes(vertex_count) > *budget) {
+        return;
+    }
+    STATS_PHASE("router_precompute");
     router_ = std::make_unique<Router>(graph_);
 }
 
 TransportRouter::RoutingSettings TransportRouter::MakeRoutingSettings(const Json::Dict& json) {
-    return {
+    RoutingSettings settings = {
         json.at("bus_wait_time").AsInt(),
         json.at("bus_velocity").AsDouble(),
     };
+    if (const auto it = json.find("router_memory_budget_mb"); it != json.end()) {
+        settings.router_memory_budget = static_cast<size_t>(it->second.AsDouble() * 1024 * 1024);
+    }
+    if (const auto it = json.find("vertex_order"); it != json.end()) {
+        const string& order = it->second.AsString();
+        if (order == "hilbert") {
+            settings.vertex_order = VertexOrder::HILBERT;
+        }
+        else if (order != "input") {
+            throw invalid_argument("unknown vertex_order " + order);
+        }
+    }
+    if (const auto it = json.find("router_table_file"); it != json.end()) {
+        settings.router_table_file = it->second.AsString();
+    }
+    return settings;
 }
 
-void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict& stops_dict) {
+TransportRouter::MemoryUsage TransportRouter::GetMemoryUsage() const {
+    MemoryUsage usage = {
+        .graph = graph_.GetHeapBytes(),
+        .edges_info = Memory::VectorBytes(edges_info_),
+        .vertices_info = Memory::VectorBytes(vertices_info_),
+        .stop_ids = Memory::HashTableBytes(stop_ids_) + Memory::VectorBytes(stops_vertex_ids_),
+        .router_table = router_ ? router_->GetHeapBytes() : 0,
+    };
+    for (const auto& edge_info : edges_info_) {
+        if (holds_alternative<BusEdgeInfo>(edge_info)) {
+            usage.edges_info += Memory::HeapBytes(get<BusEdgeInfo>(edge_info).bus_name);
+        }
+    }
+    for (const auto& vertex_info : vertices_info_) {
+        usage.vertices_info += Memory::HeapBytes(vertex_info.stop_name);
+    }
+    for (const auto& [name, _] : stop_ids_) {
+        usage.stop_ids += Memory::HeapBytes(name);
+    }
+    return usage;
+}
+
+size_t TransportRouter::MemoryUsage::GetTotal() const {
+    return graph + edges_info + vertices_info + stop_ids + router_table;
+}
+
+Json::Dict TransportRouter::MemoryReport() const {
+    const MemoryUsage usage = GetMemoryUsage();
+    return {
+        {"graph", Memory::AsKibNode(usage.graph)},
+        {"edges_info", Memory::AsKibNode(usage.edges_info)},
+        {"vertices_info", Memory::AsKibNode(usage.vertices_info)},
+        {"stop_ids", Memory::AsKibNode(usage.stop_ids)},
+        {"router_table", Memory::AsKibNode(usage.router_table)},
+        {"router_table_projected", Memory::AsKibNode(Router::EstimateTableBytes(graph_.GetVertexCount()))},
+        {"router_table_file", Memory::AsKibNode(mapped_router_ ? mapped_router_->GetFileBytes() : 0)},
+        {"router_mode", Json::Node(router_ ? "all_pairs"s : mapped_router_ ? "mapped_file"s : "dijkstra"s)},
+        {"total", Memory::AsKibNode(usage.GetTotal())},
+    };
+}
+
+Stats::GraphInfo TransportRouter::MakeGraphInfo(const Descriptions::CompactNetwork& network) const {
+    // every bus is counted, one whose route yields no edges included
+    unordered_map<string_view, size_t> edges_per_bus;
+    for (const auto& bus : network.buses) {
+        edges_per_bus[bus.bus->name];
+    }
+    for (const auto& edge_info : edges_info_) {
+        if (holds_alternative<BusEdgeInfo>(edge_info)) {
+            ++edges_per_bus[get<BusEdgeInfo>(edge_info).bus_name];
+        }
+    }
+
+    Stats::GraphInfo info = {
+        .vertex_count = graph_.GetVertexCount(),
+        .edge_count = graph_.GetEdgeCount(),
+        .bus_count = edges_per_bus.size(),
+    };
+    if (!edges_per_bus.empty()) {
+        info.min_edges_per_bus = edges_per_bus.begin()->second;
+    }
+    for (const auto& [_, edge_count] : edges_per_bus) {
+        info.bus_edge_count += edge_count;
+        info.min_edges_per_bus = min(info.min_edges_per_bus, edge_count);
+        info.max_edges_per_bus = max(info.max_edges_per_bus, edge_count);
+    }
+    return info;
+}
+
+void TransportRouter::FillGraphWithStops(const Descriptions::CompactNetwork& network) {
     Graph::VertexId vertex_id = 0;
 
-    for (const auto& [stop_name, _] : stops_dict) {
-        auto& vertex_ids = stops_vertex_ids_[stop_name];
+    stops_vertex_ids_.resize(network.stops.size());
+    for (const Descriptions::StopId stop_id : MakeStopsOrder(network)) {
+        const string& stop_name = network.stops[stop_id]->name;
+        stop_ids_[stop_name] = stop_id;
+        auto& vertex_ids = stops_vertex_ids_[stop_id];
         vertex_ids.in = vertex_id++;
         vertex_ids.out = vertex_id++;
-        vertices_info_[vertex_ids.in] = { stop_name };
-        vertices_info_[vertex_ids.out] = { stop_name };
+        vertices_info_[vertex_ids.in] = { stop_name, stop_id };
+        vertices_info_[vertex_ids.out] = { stop_name, stop_id };
 
         edges_info_.push_back(WaitEdgeInfo{});
         graph_.AddEdge({
@@ -46,39 +160,127 @@ void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict& stops_di
     assert(vertex_id == graph_.GetVertexCount());
 }
 
-void TransportRouter::FillGraphWithBuses(const Descriptions::StopsDict& stops_dict,
-    const Descriptions::BusesDict& buses_dict) {
-    for (const auto& [_, bus_item] : buses_dict) {
-        const auto& bus = *bus_item;
-        const size_t stop_count = bus.stops.size();
-        if (stop_count <= 1) {
-            continue;
+// Position of (x, y) along the Hilbert curve filling a 2^16 x 2^16 grid
+static uint64_t ComputeHilbertIndex(uint32_t x, uint32_t y) {
+    const uint32_t side = 1u << 16;
+    uint64_t index = 0;
+    for (uint32_t half = side / 2; half > 0; half /= 2) {
+        const uint32_t rx = (x & half) > 0;
+        const uint32_t ry = (y & half) > 0;
+        index += uint64_t{ half } * half * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            swap(x, y);
         }
-        auto compute_distance_from = [&stops_dict, &bus](size_t lhs_idx) {
-            return Descriptions::ComputeStopsDistance(*stops_dict.at(bus.stops[lhs_idx]), *stops_dict.at(bus.stops[lhs_idx + 1]));
-        };
-        for (size_t start_stop_idx = 0; start_stop_idx + 1 < stop_count; ++start_stop_idx) {
-            const Graph::VertexId start_vertex = stops_vertex_ids_[bus.stops[start_stop_idx]].in;
-            int total_distance = 0;
-            for (size_t finish_stop_idx = start_stop_idx + 1; finish_stop_idx < stop_count; ++finish_stop_idx) {
-                total_distance += compute_distance_from(finish_stop_idx - 1);
-                edges_info_.push_back(BusEdgeInfo{
-                    .bus_name = bus.name,
-                    .span_count = finish_stop_idx - start_stop_idx,
-                    });
-                graph_.AddEdge({
+    }
+    return index;
+}
+
+vector<Descriptions::StopId> TransportRouter::MakeStopsOrder(const Descriptions::CompactNetwork& network) const {
+    vector<Descriptions::StopId> order(network.stops.size());
+    iota(order.begin(), order.end(), Descriptions::StopId{ 0 });
+    if (routing_settings_.vertex_order != VertexOrder::HILBERT || order.empty()) {
+        return order;
+    }
+
+    double min_lat = numeric_limits<double>::max();
+    double max_lat = numeric_limits<double>::lowest();
+    double min_lon = numeric_limits<double>::max();
+    double max_lon = numeric_limits<double>::lowest();
+    for (const auto* stop : network.stops) {
+        min_lat = min(min_lat, stop->position.latitude);
+        max_lat = max(max_lat, stop->position.latitude);
+        min_lon = min(min_lon, stop->position.longitude);
+        max_lon = max(max_lon, stop->position.longitude);
+    }
+    auto to_grid = [](double value, double min_value, double max_value) {
+        const double span = max_value - min_value;
+        return span > 0 ? static_cast<uint32_t>((value - min_value) / span * ((1 << 16) - 1)) : 0u;
+    };
+
+    vector<uint64_t> indices(network.stops.size());
+    for (Descriptions::StopId stop_id = 0; stop_id < network.stops.size(); ++stop_id) {
+        const auto& position = network.stops[stop_id]->position;
+        indices[stop_id] = ComputeHilbertIndex(
+            to_grid(position.longitude, min_lon, max_lon),
+            to_grid(position.latitude, min_lat, max_lat));
+    }
+    // stable, so stops in the same grid cell keep their input order
+    stable_sort(order.begin(), order.end(), [&indices](Descriptions::StopId lhs, Descriptions::StopId rhs) {
+        return indices[lhs] < indices[rhs];
+    });
+    return order;
+}
+
+void TransportRouter::FillGraphWithBuses(const Descriptions::CompactNetwork& network, size_t thread_count) {
+    // Edges are generated per bus in parallel and then appended in network order,
+    // so edge ids do not depend on thread_count
+    vector<vector<BusEdge>> bus_edges(network.buses.size());
+    ForEachChunkParallel(network.buses.size(), thread_count, [&](size_t first, size_t last) {
+        for (size_t bus_idx = first; bus_idx < last; ++bus_idx) {
+            bus_edges[bus_idx] = MakeBusEdges(network, network.buses[bus_idx]);
+        }
+    });
+
+    for (size_t bus_idx = 0; bus_idx < network.buses.size(); ++bus_idx) {
+        for (const BusEdge& bus_edge : bus_edges[bus_idx]) {
+            edges_info_.push_back(BusEdgeInfo{
+                .bus_name = network.buses[bus_idx].bus->name,
+                .span_count = bus_edge.span_count,
+                });
+            graph_.AddEdge(bus_edge.edge);
+        }
+        bus_edges[bus_idx].clear();
+        bus_edges[bus_idx].shrink_to_fit();
+    }
+}
+
+vector<TransportRouter::BusEdge> TransportRouter::MakeBusEdges(const Descriptions::CompactNetwork& network,
+    const Descriptions::CompactBus& bus) const {
+    const auto route = bus.GetRoute();
+    const size_t stop_count = route.size();
+    if (stop_count <= 1) {
+        return {};
+    }
+    auto compute_distance_from = [&network, &route](size_t lhs_idx) {
+        return network.road_distances.Get(route[lhs_idx], route[lhs_idx + 1]);
+    };
+    vector<BusEdge> edges;
+    edges.reserve(stop_count * (stop_count - 1) / 2);
+    for (size_t start_stop_idx = 0; start_stop_idx + 1 < stop_count; ++start_stop_idx) {
+        const Graph::VertexId start_vertex = stops_vertex_ids_[route[start_stop_idx]].in;
+        int total_distance = 0;
+        for (size_t finish_stop_idx = start_stop_idx + 1; finish_stop_idx < stop_count; ++finish_stop_idx) {
+            total_distance += compute_distance_from(finish_stop_idx - 1);
+            edges.push_back({
+                .edge = {
                     start_vertex,
-                    stops_vertex_ids_[bus.stops[finish_stop_idx]].out,
+                    stops_vertex_ids_[route[finish_stop_idx]].out,
                     total_distance * 1.0 / (routing_settings_.bus_velocity * 1000.0 / 60)  // m / (km/h * 1000 / 60) = min
-                    });
-            }
+                },
+                .span_count = finish_stop_idx - start_stop_idx,
+                });
         }
     }
+    return edges;
 }
 
 optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& stop_from, const string& stop_to) const {
-    const Graph::VertexId vertex_from = stops_vertex_ids_.at(stop_from).out;
-    const Graph::VertexId vertex_to = stops_vertex_ids_.at(stop_to).out;
+    const Graph::VertexId vertex_from = stops_vertex_ids_[stop_ids_.at(stop_from)].out;
+    const Graph::VertexId vertex_to = stops_vertex_ids_[stop_ids_.at(stop_to)].out;
+    if (!router_) {
+        const auto path = mapped_router_
+            ? mapped_router_->BuildRoute(vertex_from, vertex_to)
+            : Graph::FindShortestPath(graph_, vertex_from, vertex_to);
+        if (!path) {
+            return nullopt;
+        }
+        return MakeRouteInfo(*path);
+    }
+
     const auto route = router_->BuildRoute(vertex_from, vertex_to);
     if (!route) {
         return nullopt;
@@ -87,24 +289,7 @@ optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& st
     RouteInfo route_info = { .total_time = route->weight };
     route_info.items.reserve(route->edge_count);
     for (size_t edge_idx = 0; edge_idx < route->edge_count; ++edge_idx) {
-        const Graph::EdgeId edge_id = router_->GetRouteEdge(route->id, edge_idx);
-        const auto& edge = graph_.GetEdge(edge_id);
-        const auto& edge_info = edges_info_[edge_id];
-        if (holds_alternative<BusEdgeInfo>(edge_info)) {
-            const BusEdgeInfo& bus_edge_info = get<BusEdgeInfo>(edge_info);
-            route_info.items.push_back(RouteInfo::BusItem{
-                .bus_name = bus_edge_info.bus_name,
-                .time = edge.weight,
-                .span_count = bus_edge_info.span_count,
-                });
-        }
-        else {
-            const Graph::VertexId vertex_id = edge.from;
-            route_info.items.push_back(RouteInfo::WaitItem{
-                .stop_name = vertices_info_[vertex_id].stop_name,
-                .time = edge.weight,
-                });
-        }
+        route_info.items.push_back(MakeRouteItem(router_->GetRouteEdge(route->id, edge_idx)));
     }
 
     // Releasing in destructor of some proxy object would be better,
@@ -112,3 +297,69 @@ optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& st
     router_->ReleaseRoute(route->id);
     return route_info;
 }
+
+optional<vector<TransportRouter::ReachableStop>> TransportRouter::FindReachableStops(const string& stop_from, double max_time) const {
+    const auto stop_it = stop_ids_.find(stop_from);
+    if (stop_it == stop_ids_.end()) {
+        return nullopt;
+    }
+    // a passenger is at a stop on its out vertex, the in vertex is only reached after the wait
+    vector<ReachableStop> stops;
+    for (const auto& [vertex, time] : Graph::FindReachableVertices(graph_, stops_vertex_ids_[stop_it->second].out, max_time)) {
+        const VertexInfo& vertex_info = vertices_info_[vertex];
+        if (stops_vertex_ids_[vertex_info.stop_id].out == vertex) {
+            stops.push_back({ vertex_info.stop_name, time });
+        }
+    }
+    return stops;
+}
+
+vector<TransportRouter::RouteInfo> TransportRouter::FindParetoRoutes(const string& stop_from, const string& stop_to, size_t max_boardings) const {
+    const auto from_it = stop_ids_.find(stop_from);
+    const auto to_it = stop_ids_.find(stop_to);
+    if (from_it == stop_ids_.end() || to_it == stop_ids_.end()) {
+        return {};
+    }
+    const Graph::VertexId vertex_from = stops_vertex_ids_[from_it->second].out;
+    const Graph::VertexId vertex_to = stops_vertex_ids_[to_it->second].out;
+    const auto paths = Graph::FindParetoPaths(graph_, vertex_from, vertex_to, min(max_boardings, MAX_PARETO_BOARDINGS),
+        [this](Graph::EdgeId edge_id) {
+            return holds_alternative<BusEdgeInfo>(edges_info_[edge_id]);
+        });
+
+    vector<RouteInfo> routes;
+    routes.reserve(paths.size());
+    for (const auto& path : paths) {
+        routes.push_back(MakeRouteInfo(path));
+    }
+    return routes;
+}
+
+TransportRouter::RouteInfo TransportRouter::MakeRouteInfo(const Graph::Path<double>& path) const {
+    RouteInfo route_info = { .total_time = path.weight };
+    route_info.items.reserve(path.edges.size());
+    for (const Graph::EdgeId edge_id : path.edges) {
+        route_info.items.push_back(MakeRouteItem(edge_id));
+    }
+    return route_info;
+}
+
+TransportRouter::RouteInfo::Item TransportRouter::MakeRouteItem(Graph::EdgeId edge_id) const {
+    const auto& edge = graph_.GetEdge(edge_id);
+    const auto& edge_info = edges_info_[edge_id];
+    if (holds_alternative<BusEdgeInfo>(edge_info)) {
+        const BusEdgeInfo& bus_edge_info = get<BusEdgeInfo>(edge_info);
+        return RouteInfo::BusItem{
+            .bus_name = bus_edge_info.bus_name,
+            .time = edge.weight,
+            .span_count = bus_edge_info.span_count,
+        };
+    }
+    else {
+        const Graph::VertexId vertex_id = edge.from;
+        return RouteInfo::WaitItem{
+            .stop_name = vertices_info_[vertex_id].stop_name,
+            .time = edge.weight,
+        };
+    }
+}
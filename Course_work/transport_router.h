@@ -3,7 +3,9 @@
 #include "descriptions.h"
 #include "graph.h"
 #include "json.h"
+#include "mapped_router.h"
 #include "router.h"
+#include "stats.h"
 
 #include <memory>
 #include <unordered_map>
@@ -15,9 +17,9 @@ private:
     using Router = Graph::Router<double>;
 
 public:
-    TransportRouter(const Descriptions::StopsDict& stops_dict,
-        const Descriptions::BusesDict& buses_dict,
-        const Json::Dict& routing_settings_json);
+    TransportRouter(const Descriptions::CompactNetwork& network,
+        const Json::Dict& routing_settings_json,
+        size_t thread_count = 1);
 
     struct RouteInfo {
         double total_time;
@@ -38,18 +40,68 @@ public:
 
     std::optional<RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to) const;
 
+    struct ReachableStop {
+        std::string_view stop_name;
+        double time;
+    };
+    // Stops whose arrival time from stop_from is within max_time, ordered by time, stop_from itself included.
+    // Empty optional for an unknown stop.
+    std::optional<std::vector<ReachableStop>> FindReachableStops(const std::string& stop_from, double max_time) const;
+
+    // Routes that are Pareto-optimal in (total time, number of boardings), fewest boardings first.
+    // max_boardings bounds the labels kept per vertex and is clamped to MAX_PARETO_BOARDINGS,
+    // so routes needing more boardings than that are not found; ParetoRoute requests reject larger values.
+    // Empty for an unknown stop.
+    static const size_t MAX_PARETO_BOARDINGS = 8;
+    std::vector<RouteInfo> FindParetoRoutes(const std::string& stop_from, const std::string& stop_to, size_t max_boardings) const;
+
+    // Estimated heap bytes per structure
+    struct MemoryUsage {
+        size_t graph;
+        size_t edges_info;
+        size_t vertices_info;
+        size_t stop_ids;
+        size_t router_table;
+
+        size_t GetTotal() const;
+    };
+    MemoryUsage GetMemoryUsage() const;
+    // The same in KiB, in the shape printed by --memory-report
+    Json::Dict MemoryReport() const;
+
 private:
+    enum class VertexOrder {
+        INPUT,  // stops keep their network ids
+        HILBERT,  // stops sorted along a Hilbert curve, so nearby stops get nearby vertex ids
+    };
+
     struct RoutingSettings {
         int bus_wait_time;  // in minutes
         double bus_velocity;  // km/h
+        std::optional<size_t> router_memory_budget;  // bytes for the all-pairs table, unlimited if empty
+        std::optional<std::string> router_table_file;  // keeps the all-pairs table in this file instead of the heap
+        VertexOrder vertex_order = VertexOrder::INPUT;
     };
 
     static RoutingSettings MakeRoutingSettings(const Json::Dict& json);
 
-    void FillGraphWithStops(const Descriptions::StopsDict& stops_dict);
+    Stats::GraphInfo MakeGraphInfo(const Descriptions::CompactNetwork& network) const;
+
+    RouteInfo::Item MakeRouteItem(Graph::EdgeId edge_id) const;
+    RouteInfo MakeRouteInfo(const Graph::Path<double>& path) const;
+
+    // Order in which stops get their vertex ids
+    std::vector<Descriptions::StopId> MakeStopsOrder(const Descriptions::CompactNetwork& network) const;
+    void FillGraphWithStops(const Descriptions::CompactNetwork& network);
 
-    void FillGraphWithBuses(const Descriptions::StopsDict& stops_dict,
-        const Descriptions::BusesDict& buses_dict);
+    void FillGraphWithBuses(const Descriptions::CompactNetwork& network, size_t thread_count);
+
+    struct BusEdge {
+        Graph::Edge<double> edge;
+        size_t span_count;
+    };
+    std::vector<BusEdge> MakeBusEdges(const Descriptions::CompactNetwork& network,
+        const Descriptions::CompactBus& bus) const;
 
     struct StopVertexIds {
         Graph::VertexId in;
@@ -57,6 +109,7 @@ private:
     };
     struct VertexInfo {
         std::string stop_name;
+        Descriptions::StopId stop_id;
     };
 
     struct BusEdgeInfo {
@@ -68,8 +121,10 @@ private:
 
     RoutingSettings routing_settings_;
     BusGraph graph_;
-    std::unique_ptr<Router> router_;
-    std::unordered_map<std::string, StopVertexIds> stops_vertex_ids_;
+    std::unique_ptr<Router> router_;  // null when the table exceeds router_memory_budget or lives in a file
+    std::unique_ptr<Graph::MappedRouter<double>> mapped_router_;
+    std::unordered_map<std::string, Descriptions::StopId> stop_ids_;
+    std::vector<StopVertexIds> stops_vertex_ids_;  // indexed by StopId
     std::vector<VertexInfo> vertices_info_;
     std::vector<EdgeInfo> edges_info_;
 };
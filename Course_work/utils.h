@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <future>
 #include <iterator>
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 template <typename It>
 class Range {
@@ -24,6 +28,55 @@ auto AsRange(const C& container) {
     return Range{ std::begin(container), std::end(container) };
 }
 
+// Traversal order of a bus route that is stored once:
+// a roundtrip route is walked as is, a linear one there and back
+template <typename Item>
+class RouteView {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Item;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Item*;
+        using reference = const Item&;
+
+        Iterator(const RouteView* route, size_t idx) : route_(route), idx_(idx) {}
+
+        reference operator*() const { return (*route_)[idx_]; }
+        pointer operator->() const { return &(*route_)[idx_]; }
+        Iterator& operator++() { ++idx_; return *this; }
+        Iterator operator++(int) { Iterator result = *this; ++idx_; return result; }
+        bool operator==(const Iterator& other) const { return idx_ == other.idx_; }
+        bool operator!=(const Iterator& other) const { return idx_ != other.idx_; }
+
+    private:
+        const RouteView* route_;
+        size_t idx_;
+    };
+
+    RouteView(const std::vector<Item>& items, bool is_roundtrip) : items_(items), is_roundtrip_(is_roundtrip) {}
+
+    size_t size() const {
+        return is_roundtrip_ || items_.empty() ? items_.size() : items_.size() * 2 - 1;
+    }
+
+    const Item& operator[](size_t idx) const {
+        return idx < items_.size() ? items_[idx] : items_[items_.size() * 2 - 2 - idx];
+    }
+
+    Iterator begin() const { return { this, 0 }; }
+    Iterator end() const { return { this, size() }; }
+
+    // Stops in the order they are stored, each segment of a linear route appears here once
+    const std::vector<Item>& GetItems() const { return items_; }
+    bool IsRoundtrip() const { return is_roundtrip_; }
+
+private:
+    const std::vector<Item>& items_;
+    bool is_roundtrip_;
+};
+
 template <typename It>
 size_t ComputeUniqueItemsCount(Range<It> range) {
     return std::unordered_set<typename Range<It>::ValueType>{
@@ -48,4 +101,26 @@ Number ReadNumberOnLine(std::istream& stream) {
     std::string dummy;
     std::getline(stream, dummy);
     return number;
-}
\ No newline at end of file
+}
+
+// Splits [0, item_count) into contiguous chunks and calls func(first, last) for each
+// chunk on its own thread. Chunks never overlap, so func may write results by index
+// without locking. Runs inline when a single thread is requested.
+template <typename Func>
+void ForEachChunkParallel(size_t item_count, size_t thread_count, Func func) {
+    const size_t chunk_count = std::max<size_t>(1, std::min(thread_count, item_count));
+    if (chunk_count == 1) {
+        func(size_t{ 0 }, item_count);
+        return;
+    }
+    const size_t chunk_size = (item_count + chunk_count - 1) / chunk_count;
+    std::vector<std::future<void>> futures;
+    futures.reserve(chunk_count);
+    for (size_t first = 0; first < item_count; first += chunk_size) {
+        const size_t last = std::min(item_count, first + chunk_size);
+        futures.push_back(std::async(std::launch::async, [&func, first, last] { func(first, last); }));
+    }
+    for (auto& future : futures) {
+        future.get();
+    }
+}